@@ -1,16 +1,36 @@
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <sstream>
+#include <map>
 #include <unordered_map>
 #include <unordered_set>
 #include <thread>
 #include <memory>
 #include <vector>
 #include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <csignal>
+#include <unistd.h>
 #include <boost/program_options.hpp>
 #include "util/file_piece.hh"
+#include "src/align_server.h"
+#include "src/chunk_reader.h"
 #include "src/document.h"
-#include "src/blocking_queue.h"
+#include "src/document_pair.h"
+#include "src/df_table.h"
+#include "src/hashed_documents.h"
+#include "src/index_file.h"
+#include "src/mapped_file.h"
+#include "src/ngram_counter.h"
+#include "src/ngram_index.h"
+#include "src/pair_file.h"
+#include "src/run_stats.h"
+#include "src/scorer.h"
+#include "src/thread_pool.h"
 
 
 using namespace bitextor;
@@ -19,197 +39,747 @@ using namespace std;
 namespace po = boost::program_options;
 
 struct Line {
-	string str;
+	util::StringPiece str;
 	size_t n;
 };
 
-struct DocumentPair {
-	float score;
-	size_t in_idx;
-	size_t en_idx;
-};
-
-struct DocumentNGramScore {
-	size_t doc_id;
-	float tfidf;
+/**
+ * Batch of lines that point into chunks of the input file. Keeps those chunks
+ * alive until the batch has been processed. The lines are either base64
+ * encoded documents, or documents hashed into ngrams already.
+ */
+struct LineBatch {
+	vector<shared_ptr<Chunk const>> chunks;
+	vector<Line> lines;
+	bool hashed;
+
+	// Where the documents go once hashed, if they are kept for later passes,
+	// and which batch this is in the order they are written. The worker that
+	// processes the batch encodes them into `encoded`.
+	HashedDocumentFile *cache;
+	size_t seq;
+	mutable string encoded;
+	mutable size_t encoded_cnt;
+
+	inline vector<Line>::const_iterator begin() const { return lines.begin(); }
+	inline vector<Line>::const_iterator end() const { return lines.end(); }
+	inline size_t size() const { return lines.size(); }
 };
 
 constexpr size_t QUEUE_SIZE_PER_THREAD = 32;
 
 constexpr size_t BATCH_SIZE = 512;
 
+// Maximum number of threads decompressing input files that allow it
+constexpr size_t DECOMPRESS_THREADS = 4;
+
+// Number of best scoring pairs kept per English document when not printing
+// all scores.
+constexpr size_t BEST_CANDIDATES = 8;
+
+// Documents of the input files hashed into ngrams, by path. Once complete,
+// they are read instead of the file.
+typedef map<string, unique_ptr<HashedDocumentFile>> HashedDocuments;
+
 /**
- * Utility to start N threads executing fun. Returns a vector with those thread objects.
+ * What a worker needs to turn lines into documents. One per worker, so they
+ * can reuse their buffers between documents.
  */
-template <typename T> vector<thread> start(unsigned int n_threads, T fun) {
-	vector<thread> threads;
-	threads.reserve(n_threads);
-	for (unsigned int n = 0; n < n_threads; ++n)
-		threads.push_back(thread(fun, n));
-	return threads;
+struct DocumentWorkspace {
+	explicit DocumentWorkspace(size_t ngram_size)
+	: reader(ngram_size),
+	  document{0, {}},
+	  document_ref{0, {}} {
+		//
+	}
+
+	DocumentReader reader;
+	Document document;
+	DocumentRef document_ref;
+
+	// Reads line of batch into document, and encodes it for later passes if
+	// the batch is written to a HashedDocumentFile. Does not touch document.id.
+	inline void read(LineBatch const &batch, Line const &line) {
+		if (batch.hashed) {
+			decode_document(line.str, document);
+			return;
+		}
+
+		reader.read(line.str, document);
+
+		if (batch.cache) {
+			encode_document(document, batch.encoded);
+			++batch.encoded_cnt;
+		}
+	}
+};
+
+/**
+ * Reads lines into batches, and runs fun(batch, worker) on the pool for each
+ * of them. Only every `sample_rate`-th line ends up in a batch, but all lines
+ * are counted and numbered. The lines are not copied, the batches point into
+ * the chunks of the file. Returns the number of lines once all batches have
+ * been processed, and counts the input read in `stats`.
+ *
+ * If the hashed documents of `path` in `hashed_documents` are complete, the
+ * batches hold those instead of the lines of the file. With `fill_cache`, they
+ * are written while reading the file instead, which needs fun to read every
+ * line of a batch through DocumentWorkspace::read.
+ */
+template <typename F> size_t process_lines(std::string const &path, ThreadPool &pool, HashedDocuments const &hashed_documents, RunStats &stats, F fun, size_t sample_rate = 1, bool fill_cache = false)
+{
+	size_t document_count = 0;
+	size_t batch_count = 0;
+
+	auto found = hashed_documents.find(path);
+	HashedDocumentFile *cache = found != hashed_documents.end() ? found->second.get() : nullptr;
+	bool hashed = cache && cache->complete();
+
+	// Only a pass over every line can write all of them
+	HashedDocumentFile *writer = fill_cache && sample_rate == 1 && cache && cache->writable() ? cache : nullptr;
+
+	auto submit = [&pool, &fun, writer](shared_ptr<LineBatch const> line_batch) {
+		pool.submit([line_batch, &fun, writer](size_t worker) {
+			fun(*line_batch, worker);
+
+			if (writer) {
+				UTIL_THROW_IF(line_batch->encoded_cnt != line_batch->size(), util::Exception,
+					"Not every document of a batch was read while writing hashed documents");
+				writer->add(line_batch->seq, line_batch->size(), std::move(line_batch->encoded));
+			}
+		});
+	};
+
+	auto new_batch = [&]() {
+		shared_ptr<LineBatch> line_batch(make_shared<LineBatch>());
+		line_batch->lines.reserve(BATCH_SIZE);
+		line_batch->hashed = hashed;
+		line_batch->cache = writer;
+		line_batch->seq = batch_count++;
+		line_batch->encoded_cnt = 0;
+		return line_batch;
+	};
+
+	shared_ptr<LineBatch> line_batch(new_batch());
+
+	auto add_line = [&](shared_ptr<Chunk const> const &chunk, util::StringPiece const &line) {
+		if (line_batch->chunks.empty() || line_batch->chunks.back() != chunk)
+			line_batch->chunks.push_back(chunk);
+
+		line_batch->lines.push_back({
+			.str = line,
+			.n = document_count
+		});
+
+		if (line_batch->lines.size() == BATCH_SIZE) {
+			submit(std::move(line_batch));
+			line_batch = new_batch();
+		}
+	};
+
+	try {
+		if (hashed) {
+			uint64_t offset = 0;
+
+			while (true) {
+				shared_ptr<Chunk> chunk(make_shared<Chunk>());
+				size_t chunk_count = cache->read(offset, chunk->data);
+				if (chunk_count == 0)
+					break;
+
+				chunk->lines = util::StringPiece(chunk->data.data(), chunk->data.size());
+				const char *pos = chunk->lines.data();
+				const char *end = pos + chunk->lines.size();
+
+				for (size_t i = 0; i < chunk_count; ++i) {
+					size_t size;
+					pos = read_document_size(pos, end, size);
+					util::StringPiece document(pos, size);
+					pos += size;
+
+					if (document_count++ % sample_rate != 0)
+						continue;
+
+					add_line(chunk, document);
+				}
+
+				stats.add_input(chunk_count, chunk->lines.size());
+			}
+		} else {
+			ChunkReader reader(path, min(DECOMPRESS_THREADS, pool.size()));
+
+			while (shared_ptr<Chunk const> chunk = reader.next()) {
+				size_t chunk_start = document_count;
+				const char *pos = chunk->lines.data();
+				const char *end = pos + chunk->lines.size();
+
+				while (pos != end) {
+					const char *newline = static_cast<const char *>(memchr(pos, '\n', end - pos));
+					util::StringPiece line(pos, (newline ? newline : end) - pos);
+					pos = newline ? newline + 1 : end;
+
+					if (document_count++ % sample_rate != 0)
+						continue;
+
+					if (!line.empty() && line.data()[line.size() - 1] == '\r')
+						line = util::StringPiece(line.data(), line.size() - 1);
+
+					add_line(chunk, line);
+				}
+
+				stats.add_input(document_count - chunk_start, chunk->lines.size());
+			}
+
+			stats.add("input", reader.performance());
+		}
+
+		if (!line_batch->lines.empty())
+			submit(std::move(line_batch));
+	} catch (...) {
+		// The tasks refer to fun, so they have to finish before unwinding.
+		try {
+			pool.wait();
+		} catch (...) {
+			//
+		}
+		throw;
+	}
+
+	pool.wait();
+
+	if (writer)
+		writer->finish(document_count);
+
+	return document_count;
 }
 
 /**
- * Utility to stop & join threads. Needs access to the queue to supply it null pointers after which it waits
- * for the workers to stop & join.
+ * Adds pair to a heap of at most `size` pairs, with the worst pair on top.
+ * Returns false if that meant a pair had to be dropped.
  */
-template <typename T> void stop(blocking_queue<unique_ptr<T>> &queue, vector<thread> &workers) {
-	for (size_t i = 0; i < workers.size(); ++i)
-		queue.push(nullptr);
+bool keep_best(vector<DocumentPair> &heap, DocumentPair const &pair, size_t size)
+{
+	if (heap.size() < size) {
+		heap.push_back(pair);
+		push_heap(heap.begin(), heap.end(), &better_pair);
+		return true;
+	}
+
+	if (better_pair(pair, heap.front())) {
+		pop_heap(heap.begin(), heap.end(), &better_pair);
+		heap.back() = pair;
+		push_heap(heap.begin(), heap.end(), &better_pair);
+	}
 
-	for (auto &worker : workers)
-		worker.join();
+	return false;
 }
 
-ostream &operator<<(ostream &out, queue_performance const &performance) {
-	return out << "  underflow: " << performance.underflow << '\n'
-	           << "   overflow: " << performance.overflow << '\n';
+/**
+ * Picks the best pairs such that each document occurs in at most one of them:
+ * going through all pairs from best to worst, a pair is picked unless one of
+ * its documents was already picked. Sorts `pairs` along the way. Returns the
+ * picked pairs, and marks the picked English documents in `en_seen`.
+ */
+vector<DocumentPair> select_best_pairs(vector<DocumentPair> &pairs, size_t in_document_cnt, size_t en_document_cnt, vector<bool> &en_seen)
+{
+	sort(pairs.begin(), pairs.end(), &better_pair);
+
+	PairSelector selector(in_document_cnt, en_document_cnt);
+	vector<DocumentPair> best_pairs;
+
+	// For each pair (with score, sorted from good to bad), stopping once
+	// every document on one of the sides has been picked.
+	for (DocumentPair const &pair : pairs) {
+		if (selector.done())
+			break;
+
+		if (selector.add(pair))
+			best_pairs.push_back(pair);
+	}
+
+	en_seen = selector.en_seen();
+	return best_pairs;
 }
 
-void print_score(float score, size_t left_id, size_t right_id)
+/**
+ * Scores the documents in `path` for which selected(id) is true against all
+ * reference documents, and adds all pairs that meet the threshold to `pairs`.
+ * Returns the number of documents read.
+ */
+template <typename F> size_t collect_pairs(std::string const &path, F selected, size_t ngram_size, DFTable const &df, NGramIndex const &ref_index, size_t ref_document_cnt, float threshold, ThreadPool &pool, HashedDocuments const &hashed_documents, RunStats &stats, vector<DocumentPair> &pairs)
 {
-	cout << fixed << setprecision(5)
-	     << score
-	     << '\t' << left_id
-	     << '\t' << right_id
-	     << '\n';
+	vector<DocumentWorkspace> workspaces(pool.size(), DocumentWorkspace(ngram_size));
+	vector<unique_ptr<Scorer>> scorers(pool.size());
+	vector<vector<DocumentPair>> worker_pairs(pool.size());
+
+	size_t read_cnt = process_lines(path, pool, hashed_documents, stats, [&](LineBatch const &line_batch, size_t worker) {
+		DocumentWorkspace &workspace = workspaces[worker];
+
+		if (!scorers[worker])
+			scorers[worker].reset(new Scorer(ref_index, ref_document_cnt, threshold));
+
+		for (Line const &line : line_batch) {
+			if (!selected(line.n))
+				continue;
+
+			workspace.document.id = line.n;
+			workspace.read(line_batch, line);
+			calculate_tfidf(workspace.document, workspace.document_ref, df);
+
+			scorers[worker]->score(workspace.document_ref, [&](size_t in_idx, float score) {
+				if (score >= threshold)
+					worker_pairs[worker].push_back(DocumentPair{score, in_idx, line.n});
+			});
+		}
+	});
+
+	for (vector<DocumentPair> const &found : worker_pairs)
+		pairs.insert(pairs.end(), found.begin(), found.end());
+
+	return read_cnt;
 }
 
-size_t queue_lines(util::LineIterator it, util::LineIterator end, blocking_queue<unique_ptr<vector<Line>>> &queue)
+/**
+ * Reads the translated documents in `path` with ids in [first_id, last_id)
+ * into an index of their tfidf vectors. The other documents are skipped.
+ */
+NGramIndex build_index(std::string const &path, size_t ngram_size, DFTable const &df, size_t in_document_cnt, size_t first_id, size_t last_id, ThreadPool &pool, HashedDocuments const &hashed_documents, RunStats &stats)
 {
-	size_t document_count = 0;
+	IndexBuilder index_builder(pool.size());
+	vector<DocumentWorkspace> workspaces(pool.size(), DocumentWorkspace(ngram_size));
+
+	size_t refs_cnt = process_lines(path, pool, hashed_documents, stats, [&](LineBatch const &line_batch, size_t worker) {
+		DocumentWorkspace &workspace = workspaces[worker];
+
+		for (Line const &line : line_batch) {
+			if (line.n < first_id || line.n >= last_id)
+				continue;
+
+			workspace.document.id = line.n;
+			workspace.read(line_batch, line);
+
+			// DF is accessed read-only. N starts counting at 1.
+			calculate_tfidf(workspace.document, workspace.document_ref, df);
+
+			for (auto const &entry : workspace.document_ref.wordvec) {
+				index_builder.add(worker, IndexEntry{
+					.ngram = entry.hash,
+					.doc_id = static_cast<uint32_t>(line.n),
+					.tfidf = entry.tfidf
+				});
+			}
+		}
+	});
+
+	UTIL_THROW_IF(refs_cnt != in_document_cnt, util::Exception, "Line count changed"
+		<< " from " << in_document_cnt << " to " << refs_cnt
+		<< " while reading " << path
+		<< " in a second pass.");
+
+	return NGramIndex(std::move(index_builder), pool);
+}
+
+// Estimated memory per posting at the peak of building the index: the entry
+// collected by a worker, its copy in a sorted shard, and the posting itself
+// with its share of the keys and the lookup table.
+constexpr size_t INDEX_BYTES_PER_POSTING = 40;
+
+/**
+ * Splits the translated documents in `path` into ranges of consecutive ids
+ * whose index should take at most `memory_limit` bytes to build. Returns the
+ * first id of each range, followed by one past the last id. Also finds the
+ * smallest and largest positive tfidf in all of them, so the indexes of the
+ * ranges can be packed the same way as a single index.
+ */
+vector<size_t> partition_documents(std::string const &path, size_t ngram_size, DFTable const &df, size_t in_document_cnt, size_t memory_limit, ThreadPool &pool, HashedDocuments const &hashed_documents, RunStats &stats, float &min_score, float &max_score)
+{
+	vector<size_t> postings(in_document_cnt, 0);
+	vector<DocumentWorkspace> workspaces(pool.size(), DocumentWorkspace(ngram_size));
+	vector<float> worker_min(pool.size(), numeric_limits<float>::max());
+	vector<float> worker_max(pool.size(), 0);
+
+	size_t refs_cnt = process_lines(path, pool, hashed_documents, stats, [&](LineBatch const &line_batch, size_t worker) {
+		DocumentWorkspace &workspace = workspaces[worker];
+
+		for (Line const &line : line_batch) {
+			if (line.n > postings.size())
+				continue;
+
+			workspace.document.id = line.n;
+			workspace.read(line_batch, line);
+			calculate_tfidf(workspace.document, workspace.document_ref, df);
+			postings[line.n - 1] = workspace.document_ref.wordvec.size();
+
+			for (auto const &entry : workspace.document_ref.wordvec) {
+				if (entry.tfidf > 0) {
+					worker_min[worker] = min(worker_min[worker], entry.tfidf);
+					worker_max[worker] = max(worker_max[worker], entry.tfidf);
+				}
+			}
+		}
+	});
 
-	while (it != end) {
-		unique_ptr<vector<Line>> line_batch(new vector<Line>());
-		line_batch->reserve(BATCH_SIZE);
+	min_score = *min_element(worker_min.begin(), worker_min.end());
+	max_score = *max_element(worker_max.begin(), worker_max.end());
 
-		for (size_t i = 0; i < BATCH_SIZE; ++i) {
-			line_batch->push_back({
-				.str = string(it->data(), it->size()),
-				.n = ++document_count
+	UTIL_THROW_IF(refs_cnt != in_document_cnt, util::Exception, "Line count changed"
+		<< " from " << in_document_cnt << " to " << refs_cnt
+		<< " while reading " << path
+		<< " in a second pass.");
+
+	vector<size_t> ranges{1};
+	size_t range_size = 0;
+
+	for (size_t id = 1; id <= in_document_cnt; ++id) {
+		size_t size = postings[id - 1] * INDEX_BYTES_PER_POSTING;
+
+		// A document that does not fit on its own still gets a range
+		if (range_size > 0 && range_size + size > memory_limit) {
+			ranges.push_back(id);
+			range_size = 0;
+		}
+
+		range_size += size;
+	}
+
+	ranges.push_back(in_document_cnt + 1);
+	return ranges;
+}
+
+/**
+ * Reads and scores the documents in `path` for which selected(id) is true
+ * against the reference documents in ref_index. With print_all, prints every pair that meets the threshold.
+ * Otherwise adds the best BEST_CANDIDATES pairs of each document to `pairs`,
+ * and the documents that had more candidates than that to `truncated`.
+ * Returns the number of documents read.
+ */
+template <typename F> size_t score_documents(std::string const &path, F selected, size_t ngram_size, DFTable const &df, NGramIndex const &ref_index, size_t ref_document_cnt, float threshold, bool print_all, ThreadPool &pool, HashedDocuments const &hashed_documents, RunStats &stats, vector<DocumentPair> &pairs, vector<size_t> &truncated)
+{
+	// Mutex for printing to stdout with print_all
+	mutex print_mutex;
+
+	// Best scoring candidate pairs (that meet the threshold) for each English
+	// document, and the English documents that had more candidates than
+	// that, per worker. Only used without print_all.
+	vector<vector<DocumentPair>> worker_pairs(pool.size());
+	vector<vector<size_t>> worker_truncated(pool.size());
+
+	// Number of pairs that met the threshold, per worker
+	vector<size_t> worker_found(pool.size(), 0);
+
+	vector<DocumentWorkspace> workspaces(pool.size(), DocumentWorkspace(ngram_size));
+	vector<unique_ptr<Scorer>> scorers(pool.size());
+
+	// Heap of the best pairs for the current document, worst on top, per worker
+	vector<vector<DocumentPair>> candidates(pool.size());
+
+	// Each batch is read, turned into tfidf vectors and scored by the same
+	// worker, so the documents never leave its cache.
+	size_t read_cnt = process_lines(path, pool, hashed_documents, stats, [&](LineBatch const &line_batch, size_t worker) {
+		DocumentWorkspace &workspace = workspaces[worker];
+		DocumentRef const &doc_ref = workspace.document_ref;
+
+		if (!scorers[worker])
+			scorers[worker].reset(new Scorer(ref_index, ref_document_cnt, threshold));
+
+		for (Line const &line : line_batch) {
+			if (!selected(line.n))
+				continue;
+
+			workspace.document.id = line.n;
+			workspace.read(line_batch, line);
+			calculate_tfidf(workspace.document, workspace.document_ref, df);
+
+			if (print_all) {
+				scorers[worker]->score(doc_ref, [&](size_t in_idx, float score) {
+					if (score < threshold)
+						return;
+
+					++worker_found[worker];
+					unique_lock<mutex> lock(print_mutex);
+					print_score(score, in_idx, doc_ref.id);
+				});
+				continue;
+			}
+
+			bool is_truncated = false;
+			candidates[worker].clear();
+
+			scorers[worker]->score(doc_ref, [&](size_t in_idx, float score) {
+				if (score >= threshold) {
+					++worker_found[worker];
+					is_truncated |= !keep_best(candidates[worker], DocumentPair{score, in_idx, doc_ref.id}, BEST_CANDIDATES);
+				}
 			});
 
-			if (++it == end)
-				break;
+			worker_pairs[worker].insert(worker_pairs[worker].end(), candidates[worker].begin(), candidates[worker].end());
+
+			if (is_truncated)
+				worker_truncated[worker].push_back(doc_ref.id);
 		}
+	});
 
-		queue.push(std::move(line_batch));
+	for (size_t i = 0; i < pool.size(); ++i) {
+		pairs.insert(pairs.end(), worker_pairs[i].begin(), worker_pairs[i].end());
+		vector<DocumentPair>().swap(worker_pairs[i]);
+		truncated.insert(truncated.end(), worker_truncated[i].begin(), worker_truncated[i].end());
+		stats.add("pairs", "scored", worker_found[i]);
 	}
 
-	return document_count;
+	return read_cnt;
+}
+
+/**
+ * Cuts the pairs of each English document down to the best BEST_CANDIDATES,
+ * and adds the documents that had more than that to `truncated`. Combines the
+ * candidates found against separate ranges of reference documents into the
+ * ones that would have been found against all of them at once.
+ */
+void merge_candidates(vector<DocumentPair> &pairs, vector<size_t> &truncated)
+{
+	sort(pairs.begin(), pairs.end(), [](DocumentPair const &a, DocumentPair const &b) {
+		return a.en_idx != b.en_idx ? a.en_idx < b.en_idx : better_pair(a, b);
+	});
+
+	size_t kept = 0;
+
+	for (size_t begin = 0, end = 0; begin < pairs.size(); begin = end) {
+		while (end < pairs.size() && pairs[end].en_idx == pairs[begin].en_idx)
+			++end;
+
+		if (end - begin > BEST_CANDIDATES)
+			truncated.push_back(pairs[begin].en_idx);
+
+		for (size_t i = begin; i < min(end, begin + BEST_CANDIDATES); ++i)
+			pairs[kept++] = pairs[i];
+	}
+
+	pairs.resize(kept);
 }
 
-size_t queue_lines(std::string const &path, blocking_queue<unique_ptr<vector<Line>>> &queue)
+/**
+ * Adds the size of an index to the statistics. Indexes of separate ranges of
+ * translated documents add up.
+ */
+void add_index_stats(NGramIndex const &index, RunStats &stats)
 {
-	util::FilePiece fin(path.c_str());
-	return queue_lines(fin.begin(), fin.end(), queue);
+	stats.add("index", "ngrams", index.size());
+	stats.add("index", "postings", index.postings());
+	stats.add("index", "memory_bytes", index.memory_usage());
+	stats.add("index", "list_size_histogram", index.list_size_histogram());
 }
 
-constexpr size_t kCountingThreads = 16;
+// Number of ngrams for which the estimated DF is compared to the exact DF
+constexpr size_t kDFErrorSampleSize = 1000;
+
+/**
+ * Counts the exact number of documents in `path` that each ngram in `sample`
+ * occurs in, and reports how far off the estimated counts in `sample` are.
+ */
+void report_df_error(std::vector<NGramCount> const &sample, std::string const &path, size_t ngram_size, ThreadPool &pool, HashedDocuments const &hashed_documents, RunStats &stats)
+{
+	std::unordered_map<NGram,size_t> sample_index;
+	for (size_t i = 0; i < sample.size(); ++i)
+		sample_index[sample[i].ngram] = i;
+
+	std::vector<std::vector<size_t>> counters(pool.size(), std::vector<size_t>(sample.size(), 0));
+	std::vector<DocumentWorkspace> workspaces(pool.size(), DocumentWorkspace(ngram_size));
+
+	process_lines(path, pool, hashed_documents, stats, [&](LineBatch const &line_batch, size_t worker) {
+		Document &document = workspaces[worker].document;
+
+		for (Line const &line : line_batch) {
+			workspaces[worker].read(line_batch, line);
+			for (auto const &entry : document.vocab) {
+				auto it = sample_index.find(entry.hash);
+				if (it != sample_index.end())
+					counters[worker][it->second] += 1;
+			}
+		}
+	}, 1, true);
+
+	double total_abs_error = 0, total_rel_error = 0, max_rel_error = 0;
+
+	for (size_t i = 0; i < sample.size(); ++i) {
+		size_t exact = 0;
+		for (size_t j = 0; j < counters.size(); ++j)
+			exact += counters[j][i];
+
+		double abs_error = fabs(double(sample[i].count) - double(exact));
+		double rel_error = abs_error / max(exact, size_t(1));
+		total_abs_error += abs_error;
+		total_rel_error += rel_error;
+		max_rel_error = max(max_rel_error, rel_error);
+	}
+
+	std::cerr << "DF error on " << sample.size() << " sampled ngrams:"
+	          << " mean absolute error " << total_abs_error / max(sample.size(), size_t(1))
+	          << ", mean relative error " << 100.0 * total_rel_error / max(sample.size(), size_t(1)) << "%"
+	          << ", max relative error " << 100.0 * max_rel_error << "%"
+	          << std::endl;
+}
 
-size_t compute_df(std::unordered_map<NGram,size_t> &df, std::string const &path, size_t ngram_size, size_t min_ngram_count, uint32_t batch_size = 1 << 24)
+/**
+ * Counts in how many documents of `path` each ngram occurs, in a single pass
+ * over the file. Ngrams that are already in `df` are skipped, all others that
+ * occur in at least `min_ngram_count` documents are added. The workers count
+ * into one shared counter, which holds at most `batch_size` unique ngrams in
+ * memory before spilling its counts to disk as sorted runs. The runs are
+ * merged at the end.
+ *
+ * With a `sample_rate` higher than 1 only every n-th document is counted, and
+ * the counts are multiplied by the sample rate to estimate the DF for the whole
+ * file. If `verbose` is set as well, the estimate is compared to the exact DF
+ * for a sample of the ngrams, which costs another pass over the file.
+ */
+size_t compute_df(std::unordered_map<NGram,size_t> &df, std::string const &path, ThreadPool &pool, HashedDocuments const &hashed_documents, RunStats &stats, size_t ngram_size, size_t min_ngram_count, size_t batch_size = 1 << 24, size_t sample_rate = 1, bool verbose = false)
 {
-	size_t batch = 0;
-	size_t offset = 0;
-	size_t line_count = 0; // Will be known after first loop
-
-	do {
-		// Re-open file again
-		// TODO: Ideally we could seek backwards or mark a restore point to resume
-		// decompressing from `offset`. That would be cool.
-		util::FilePiece fin(path.c_str());
-		auto line_it = fin.begin();
-
-		// Advance till offset again
-		for (size_t i = 0; i < offset; ++i)
-			++line_it;
-
-		size_t old_offset = offset;
-		
-		// ngrams we look at this batch, storing an index into the counter arrays
-		std::unordered_map<NGram,uint32_t> batch_df;
-		
-		// Per thread, we count the number of documents we see a certain entry in
-		std::array<std::vector<uint32_t>,kCountingThreads> counters{};
-		
-		// Read all the ngrams that occur in our batch
-		for (;line_it != fin.end() && batch_df.size() < batch_size; ++line_it, ++offset) {
-			Document document;
-			ReadDocument(*line_it, document, ngram_size);
+	ConcurrentNGramCounter counter(batch_size, pool.size());
+
+	std::vector<DocumentWorkspace> workspaces(pool.size(), DocumentWorkspace(ngram_size));
+
+	// Note: df is only read while counting. It is only added to once all
+	// batches have been counted.
+	size_t document_count = process_lines(path, pool, hashed_documents, stats, [&](LineBatch const &line_batch, size_t worker) {
+		Document &document = workspaces[worker].document;
+
+		for (Line const &line : line_batch) {
+			workspaces[worker].read(line_batch, line);
 			for (auto const &entry : document.vocab) {
 				// Skip ngrams we've already counted
-				if (df.find(entry.first) != df.end())
+				if (df.find(entry.hash) != df.end())
 					continue;
 
-				auto it = batch_df.find(entry.first);
-				if (it == batch_df.end()) {
-					batch_df[entry.first] = counters[0].size();
-					counters[0].push_back(1);
-				} else {
-					counters[0][it->second] += 1;
-				}
+				counter.add(worker, entry.hash);
 			}
 		}
+	}, sample_rate, true);
 
-		std::cerr << "Batch " << batch << ": read " << (offset - old_offset) << " documents with " << batch_df.size() << " unique ngrams" << std::endl;
+	counter.flush();
+	size_t runs = counter.runs();
 
-		// Read all of the data to count how often these ngrams occur in it
+	size_t unique_ngrams = 0;
+	size_t new_ngrams = 0;
 
-		// Allocate the rest of the counters for all of the counting threads
-		// (thread 0 just continues counting in the first one)
-		UTIL_THROW_IF2(counters[0].size() != batch_df.size(), "batch_df is not the same size as the counter array");
-		for (size_t i = 1; i < kCountingThreads; ++i)
-			counters[i].resize(counters[0].size(), 0);
+	// The merge produces ngrams in hash order, so the first few are as good a
+	// random sample as any.
+	std::vector<NGramCount> error_sample;
 
-		blocking_queue<unique_ptr<vector<Line>>> queue(kCountingThreads * QUEUE_SIZE_PER_THREAD);
-		std::vector<thread> workers(start(kCountingThreads, [&](size_t thread_id) {
-			while (true) {
-				unique_ptr<vector<Line>> line_batch(queue.pop());
+	// Merge the entries that occur more than min_ngram_count times in the
+	// entire dataset.
+	counter.merge([&](NGramCount const &entry) {
+		++unique_ngrams;
 
-				if (!line_batch)
-					break;
+		size_t estimated_count = entry.count * sample_rate;
 
-				for (Line const &line : *line_batch) {
-					Document document;
-					ReadDocument(line.str, document, ngram_size);
-					for (auto const &entry : document.vocab) {
-						auto it = batch_df.find(entry.first);
-						if (it != batch_df.end())
-							counters[thread_id][it->second] += 1;
-					}
-				}
-			}
-		}));
+		if (estimated_count >= min_ngram_count) {
+			df[entry.ngram] = estimated_count;
+			++new_ngrams;
+
+			if (verbose && sample_rate > 1 && error_sample.size() < kDFErrorSampleSize)
+				error_sample.push_back(NGramCount{entry.ngram, estimated_count});
+		}
+	});
+
+	std::cerr << "Read " << document_count << " documents";
+
+	if (sample_rate > 1)
+		std::cerr << " (counted " << (document_count + sample_rate - 1) / sample_rate << ")";
 
-		line_count = offset + queue_lines(line_it, fin.end(), queue);
-		stop(queue, workers);
+	std::cerr << " with " << unique_ngrams << " unique ngrams"
+	          << " (" << runs << " runs on disk): "
+	          << new_ngrams << " new ngrams added to df (" << (100.0f * new_ngrams / unique_ngrams) << "% of counted ngrams)"
+	          << std::endl;
 
-		size_t new_ngrams = 0;
+	if (!error_sample.empty())
+		report_df_error(error_sample, path, ngram_size, pool, hashed_documents, stats);
+
+	return document_count;
+}
+
+// Most frequent ngrams each worker keeps track of with approximate DF
+constexpr size_t kHeavyHitters = 1 << 14;
+
+/**
+ * Estimates in how many documents each ngram occurs, in a single pass over
+ * each of `paths`. Every worker adds the ngrams of its documents to its own
+ * count-min sketch of `sketch_bytes`, and keeps track of its most frequent
+ * ngrams. The sketches of the workers are summed into one for each file. The
+ * frequent ngrams are put in the table with their estimate, so the lookups of
+ * the ngrams that occur most never need the sketches. Like compute_df, the DF
+ * of an ngram is its count in the first file where it meets `min_ngram_count`.
+ * Stores the number of documents of each file in `document_counts`.
+ */
+DFTable compute_approx_df(std::vector<std::string> const &paths, std::vector<size_t> &document_counts, ThreadPool &pool, HashedDocuments const &hashed_documents, RunStats &stats, size_t ngram_size, size_t min_ngram_count, size_t max_ngram_count, size_t sketch_bytes, size_t sample_rate = 1, bool verbose = false)
+{
+	std::vector<CountMinSketch> sketches(pool.size(), CountMinSketch(sketch_bytes / (kCountMinDepth * sizeof(uint32_t))));
+	std::vector<HeavyHitters> heavy_hitters(pool.size(), HeavyHitters(kHeavyHitters));
+	std::vector<DocumentWorkspace> workspaces(pool.size(), DocumentWorkspace(ngram_size));
 
-		// Merge the entries that occur more than min_ngram_size times in the
-		// entire dataset.
-		for (auto it = batch_df.begin(); it != batch_df.end(); ++it) {
-			size_t ngram_count = 0;
+	// Sketches of all files, one after the other
+	std::vector<uint32_t> counters;
+	CountMinSketch &sketch = sketches.front();
 
-			// Sum counts of all the counting threads
-			for (size_t i = 0; i < kCountingThreads; ++i)
-				ngram_count += counters[i][it->second];
+	document_counts.clear();
 
-			if (ngram_count >= min_ngram_count) {
-				df[it->first] = ngram_count;
-				++new_ngrams;
+	for (std::string const &path : paths) {
+		document_counts.push_back(process_lines(path, pool, hashed_documents, stats, [&](LineBatch const &line_batch, size_t worker) {
+			Document &document = workspaces[worker].document;
+
+			for (Line const &line : line_batch) {
+				workspaces[worker].read(line_batch, line);
+				for (auto const &entry : document.vocab) {
+					sketches[worker].add(entry.hash);
+					heavy_hitters[worker].add(entry.hash);
+				}
 			}
+		}, sample_rate, true));
+
+		for (size_t i = 1; i < sketches.size(); ++i) {
+			sketch.merge(sketches[i]);
+			sketches[i].clear();
 		}
 
-		std::cerr << "Batch " << batch << ": "
-		          << new_ngrams << " new ngrams added to df (" << (100.0f * new_ngrams / batch_df.size()) << "% of counted ngrams this batch)"
-		          << " (read " << offset << " / " << line_count << " documents: "
-		          << 100.0f * offset / line_count << "%)"
-		          << std::endl;
-		++batch;
-	} while (offset < line_count);
+		double error_bound = sketch.error_bound() * sample_rate;
+
+		std::cerr << "Estimated DF of " << sketch.total() << " ngram occurrences in " << path
+		          << " with a sketch of " << sketch.width() << " x " << kCountMinDepth
+		          << ": estimates are at most " << error_bound << " documents too high for "
+		          << 100.0 * sketch.confidence() << "% of ngrams" << std::endl;
+
+		stats.add("df", "approx_occurrences", sketch.total() * sample_rate);
+		stats.set("df", "approx_error_bound_" + std::to_string(document_counts.size()), error_bound);
+
+		counters.insert(counters.end(), sketch.counters().begin(), sketch.counters().end());
+		sketch.clear();
+	}
+
+	std::unordered_map<NGram,size_t> df;
+	std::unordered_set<NGram> max_ngram_pruned;
+
+	for (HeavyHitters const &hitters : heavy_hitters) {
+		hitters.each([&](NGram const &ngram) {
+			size_t estimated_count = count_min_df(counters.data(), paths.size(), sketch.shift(), ngram.hash, sample_rate, min_ngram_count);
+			if (estimated_count > max_ngram_count)
+				max_ngram_pruned.insert(ngram);
+			else if (estimated_count > 0)
+				df[ngram] = estimated_count;
+		});
+	}
+
+	if (verbose)
+		std::cerr << "Table of frequent ngrams has " << df.size() << " entries and " << max_ngram_pruned.size() << " pruned ngrams" << std::endl;
 
-	return offset;
+	stats.set("df", "approx_sketch_width", sketch.width());
+	stats.set("df", "approx_sketch_depth", kCountMinDepth);
+	stats.set("df", "approx_confidence", sketch.confidence());
+	stats.set("df", "pruned_ngrams", max_ngram_pruned.size());
+
+	size_t document_count = 0;
+	for (size_t count : document_counts)
+		document_count += count;
+
+	return DFTable(df, max_ngram_pruned, document_count, std::move(counters), sketch.shift(), sample_rate, min_ngram_count, max_ngram_count);
 }
 
 int main(int argc, char *argv[])
@@ -226,10 +796,22 @@ int main(int argc, char *argv[])
 
 	size_t max_ngram_cnt = 1000;
 
+	size_t df_sample_rate = 1;
+
+	size_t approx_df_mb = 0;
+
+	unsigned posting_bits = 0;
+
+	size_t memory_limit = 0;
+
+	size_t shard = 1, shard_cnt = 1;
+
+	double progress_interval = 0;
+
 	bool verbose = false;
 
 	bool print_all = false;
-	
+
 	po::positional_options_description arg_desc;
 	arg_desc.add("translated-tokens", 1);
 	arg_desc.add("english-tokens", 1);
@@ -237,13 +819,25 @@ int main(int argc, char *argv[])
 	po::options_description generic_desc("Additional options");
 	generic_desc.add_options()
 		("help", "produce help message")
+		("df-sample-rate", po::value<size_t>(&df_sample_rate), "set sample rate to every n-th document (default: 1)")
 		("ngram_size,n", po::value<size_t>(&ngram_size), "ngram size (default: 2)")
 		("batch_size,b", po::value<size_t>(&batch_size), "batch size (default: 50_000_000)")
 		("jobs,j", po::value<unsigned int>(&n_threads), "set number of threads (default: all)")
 		("threshold", po::value<float>(&threshold), "set score threshold (default: 0.1)")
 		("min_count", po::value<size_t>(&min_ngram_cnt), "minimal number of documents an ngram can appear in to be included in DF (default: 2)")
 		("max_count", po::value<size_t>(&max_ngram_cnt), "maximum number of documents for ngram to to appear in (default: 1000)")
+		("approx-df", po::value<size_t>(&approx_df_mb), "estimate DF with a count-min sketch of this many MB per thread instead of counting it exactly (default: off)")
 		("all", po::bool_switch(&print_all), "print all scores, not only the best pairs")
+		("save-index", po::value<string>(), "write DF and the index of the translated documents to a file")
+		("load-index", po::value<string>(), "use DF and the index of the translated documents from a file instead of TRANSLATED-TOKENS")
+		("compress-postings", po::value<unsigned>(&posting_bits), "pack the index, with scores quantized to 8 or 16 bits (default: off)")
+		("memory-limit", po::value<size_t>(&memory_limit), "build the index in parts of at most this many MB, scoring against one at a time (default: no limit)")
+		("shard", po::value<string>(), "only score English documents I, I+N, I+2N, ... given as I/N")
+		("write-pairs", po::value<string>(), "write all pairs that meet the threshold to a file for docalign-merge, instead of printing the best pairs")
+		("hash-cache", po::value<string>(), "keep the documents of the input files hashed into ngrams in this directory, and read those instead of the files in later passes and runs with the same ngram size (default: off)")
+		("serve", po::value<string>(), "once the index is built or loaded, align batches of English documents sent to a Unix socket at this path, or on stdin and stdout if it is -, instead of ENGLISH-TOKENS")
+		("stats-json", po::value<string>(), "write the time, throughput and memory use of each phase and other statistics as JSON to a file")
+		("progress", po::value<double>(&progress_interval), "report the progress of the current phase every this many seconds")
 		("verbose,v", po::bool_switch(&verbose), "show additional output");
 	
 	po::options_description hidden_desc("Hidden options");
@@ -264,268 +858,510 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 	
-	if (vm.count("help") || !vm.count("translated-tokens") || !vm.count("english-tokens")) {
+	// With an index there is no need for the translated documents, so the only
+	// positional argument is the English documents.
+	if (vm.count("load-index") && vm.count("translated-tokens") && !vm.count("english-tokens")) {
+		vm.insert(std::make_pair("english-tokens", vm["translated-tokens"]));
+		vm.erase("translated-tokens");
+	}
+
+	// When serving, the English documents come in requests, and are only read
+	// from a file to count their ngrams in the DF.
+	bool serving = vm.count("serve");
+
+	if (vm.count("help") || (!vm.count("english-tokens") && !serving) || (!vm.count("translated-tokens") && !vm.count("load-index"))) {
 		cout << "Usage: " << argv[0]
-		     << " TRANSLATED-TOKENS ENGLISH-TOKENS\n\n"
+		     << " TRANSLATED-TOKENS ENGLISH-TOKENS\n"
+		     << "       " << argv[0] << " --load-index INDEX ENGLISH-TOKENS\n"
+		     << "       " << argv[0] << " --serve SOCKET (--load-index INDEX | TRANSLATED-TOKENS [ENGLISH-TOKENS])\n\n"
 		     << generic_desc << std::endl;
 		return 1;
 	}
 
-	unsigned int n_load_threads = n_threads;
+	if (serving && vm.count("load-index") && vm.count("english-tokens")) {
+		cerr << "--serve with --load-index takes no ENGLISH-TOKENS" << endl;
+		return 1;
+	}
 
-	// Note: I've tried many heuristics for the number of reading threads, but
-	// my conclusion was that I either have too few and the scoring threads are
-	// waiting, or the queue is filled and the reading threads are blocking
-	// anyway. On desktop (macOS) just using maximum threads everywhere was
-	// always the fastest.
-	unsigned int n_read_threads = n_threads;
+	if (serving && (vm.count("shard") || vm.count("write-pairs") || memory_limit)) {
+		cerr << "--serve cannot be combined with --shard, --write-pairs or --memory-limit" << endl;
+		return 1;
+	}
 
-	unsigned int n_score_threads = n_threads;
-	
-	// Calculate the document frequency for terms. Starts a couple of threads
-	// that parse documents and keep a local hash table for counting. At the
-	// end these tables are merged into df.
-	unordered_map<NGram,size_t> df;
-	unordered_set<NGram> max_ngram_pruned;
-	size_t in_document_cnt, en_document_cnt, document_cnt;
+	if (vm.count("load-index") && vm.count("save-index")) {
+		cerr << "--load-index and --save-index cannot be combined" << endl;
+		return 1;
+	}
 
-	// We'll use in_document_cnt later to reserve some space for the documents
-	// we want to keep in memory.
-	en_document_cnt = compute_df(df, vm["english-tokens"].as<std::string>(), ngram_size, min_ngram_cnt, batch_size);
-	in_document_cnt = compute_df(df, vm["translated-tokens"].as<std::string>(), ngram_size, min_ngram_cnt, batch_size);
-	document_cnt = in_document_cnt + en_document_cnt;
-
-	// Prune the DF table, similar to what the Python implementation does. Note
-	// that these counts are linked to sample-rate already, so if you have a
-	// sample rate of higher than 1, your min_ngram_count should also be a
-	// multiple of sample rate + 1.
-	size_t old_size = df.size();
-
-	for (auto it = df.begin(); it != df.end();) {
-		if (it->second < min_ngram_cnt) {
-			it = df.erase(it);
+	if (vm.count("shard")) {
+		char slash = 0;
+		istringstream in(vm["shard"].as<std::string>());
+		if (!(in >> shard >> slash >> shard_cnt) || slash != '/' || !in.eof() || shard < 1 || shard > shard_cnt) {
+			cerr << "--shard needs to be I/N, with I between 1 and N" << endl;
+			return 1;
 		}
-		else if (it->second > max_ngram_cnt) {
-			max_ngram_pruned.insert(it->first);
-			it = df.erase(it);
-		} else {
-			// Keep it.
-			++it;
+
+		if (!print_all && !vm.count("write-pairs")) {
+			cerr << "--shard needs --write-pairs or --all" << endl;
+			return 1;
 		}
 	}
 
-	if (verbose) {
-		cerr << "Pruned " << old_size - df.size() << " (" << 100.0 - 100.0 * df.size() / old_size << "%) entries from DF\n"
-		     << "Very frequent ngram set is now " << max_ngram_pruned.size() << " long."
-		     << endl;
+	if (print_all && vm.count("write-pairs")) {
+		cerr << "--all and --write-pairs cannot be combined" << endl;
+		return 1;
 	}
 
-	// Read translated documents & pre-calculate TF/DF for each of these documents
-	unordered_map<NGram, vector<DocumentNGramScore>> ref_index;
-	
-	{
-		mutex ref_index_mutex;
+	if (approx_df_mb && vm.count("load-index")) {
+		cerr << "--approx-df cannot be combined with --load-index" << endl;
+		return 1;
+	}
 
-		blocking_queue<unique_ptr<vector<Line>>> queue(n_load_threads * QUEUE_SIZE_PER_THREAD);
-		vector<thread> workers(start(n_load_threads, [&queue, &ref_index, &ref_index_mutex, &df, &max_ngram_pruned, &document_cnt, &ngram_size](size_t) {
-			unordered_map<NGram, vector<DocumentNGramScore>> local_ref_index;
+	if (memory_limit && (vm.count("load-index") || vm.count("save-index"))) {
+		cerr << "--memory-limit cannot be combined with --load-index or --save-index" << endl;
+		return 1;
+	}
 
-			while (true) {
-				unique_ptr<vector<Line>> line_batch(queue.pop());
+	if (ngram_size < 1 || ngram_size > NGramIter::kMaxNGramSize) {
+		cerr << "--ngram_size needs to be between 1 and " << NGramIter::kMaxNGramSize << endl;
+		return 1;
+	}
 
-				if (!line_batch)
-					break;
+	if (df_sample_rate < 1) {
+		cerr << "--df-sample-rate needs to be 1 or higher" << endl;
+		return 1;
+	}
 
-				for (Line const &line : *line_batch) {
-					Document doc{.id = line.n, .vocab = {}};
-					ReadDocument(line.str, doc, ngram_size);
-
-					// Note that each worker writes to a different line in the refs
-					// vector and the vector has been initialized with enough lines
-					// so there should be no concurrency issue.
-					// DF is accessed read-only. N starts counting at 1.
-					DocumentRef ref;
-					calculate_tfidf(doc, ref, document_cnt, df, max_ngram_pruned);
-
-					for (auto const &entry : ref.wordvec) {
-						local_ref_index[entry.hash].push_back(DocumentNGramScore{
-							.doc_id = line.n,
-							.tfidf = entry.tfidf
-						});
-					}
-				}
-			}
+	if (posting_bits != 0 && posting_bits != 8 && posting_bits != 16) {
+		cerr << "--compress-postings needs to be 8 or 16" << endl;
+		return 1;
+	}
 
-			{
-				// Merge the local index we built into the global one
-				unique_lock<mutex> lock(ref_index_mutex);
-				for (auto &entry : local_ref_index) {
-					auto &dest = ref_index[entry.first];
+	if (vm.count("progress") && progress_interval <= 0) {
+		cerr << "--progress needs a positive number of seconds" << endl;
+		return 1;
+	}
 
-					// Minor optimisation: copy the fewest elements possible
-					if (dest.size() < entry.second.size())
-						swap(dest, entry.second);
+	// Time and throughput of each phase, for --stats-json and --progress
+	RunStats run_stats;
 
-					dest.reserve(dest.size() + entry.second.size());
-					
-					std::move(entry.second.begin(), entry.second.end(), back_inserter(dest));
-				}
-			}
-		}));
+	// All phases share the same workers: counting, building the index, and
+	// reading and scoring the English documents.
+	ThreadPool pool(n_threads, n_threads * QUEUE_SIZE_PER_THREAD);
 
-		size_t refs_cnt = queue_lines(vm["translated-tokens"].as<std::string>(), queue);
+	if (progress_interval > 0)
+		run_stats.start_progress(progress_interval, cerr);
 
-		UTIL_THROW_IF(refs_cnt != in_document_cnt, util::Exception, "Line count changed"
-			<< " from " << in_document_cnt << " to " << refs_cnt
-			<< " while reading " << vm["translated-tokens"].as<std::string>() 
-			<< " in a second pass.");
-		
-		stop(queue, workers);
+	// Only filled with --hash-cache
+	HashedDocuments hashed_documents;
 
-		if (verbose)
-			cerr << "Read " << refs_cnt << " documents into memory" << endl;
+	// Hashed documents of path with --hash-cache. With `create`, they are
+	// written during the first pass over the file if no earlier run kept them.
+	auto use_hash_cache = [&](std::string const &path, bool create) {
+		if (!vm.count("hash-cache") || hashed_documents.count(path))
+			return;
 
-		if (verbose)
-			cerr << "Load queue performance:\n" << queue.performance();
-	}
+		unique_ptr<HashedDocumentFile> cache(new HashedDocumentFile(path, ngram_size, vm["hash-cache"].as<std::string>(), create));
 
-	// Start reading the other set of documents we match against and do the matching.
-	{
-		blocking_queue<unique_ptr<vector<Line>>> read_queue(n_read_threads * QUEUE_SIZE_PER_THREAD);
+		if (cache->complete()) {
+			if (verbose)
+				cerr << "Reading the " << cache->document_cnt() << " documents of " << path << " from " << cache->path() << endl;
+		} else if (!cache->writable()) {
+			if (create)
+				cerr << "Note: not keeping hashed documents of " << path << " in " << vm["hash-cache"].as<std::string>() << endl;
+			return;
+		}
 
-		blocking_queue<unique_ptr<vector<DocumentRef>>> score_queue(n_score_threads * QUEUE_SIZE_PER_THREAD);
+		hashed_documents[path] = std::move(cache);
+	};
 
-		vector<thread> read_workers(start(n_read_threads, [&read_queue, &score_queue, &document_cnt, &df, &max_ngram_pruned, &ngram_size](size_t) {
-			while (true) {
-				unique_ptr<vector<Line>> line_batch(read_queue.pop());
+	auto write_stats = [&]() {
+		if (!vm.count("stats-json"))
+			return;
 
-				// Empty pointer is poison
-				if (!line_batch)
-					break;
+		run_stats.add("pool_submit", pool.submit_performance());
+		run_stats.set("queues", "pool_idle_ns", size_t(pool.idle_ns()));
+		run_stats.set("run", "threads", pool.size());
+
+		ofstream out(vm["stats-json"].as<std::string>());
+		run_stats.write_json(out);
+		UTIL_THROW_IF(!out, util::ErrnoException, "Could not write statistics to " << vm["stats-json"].as<std::string>());
+	};
+
+	// Document frequency of each ngram, and the index of the translated documents
+	// with their tfidf scores. Either computed from the input, or loaded from an
+	// index file saved by an earlier run.
+	DFTable df_table;
+	NGramIndex ref_index;
+	size_t in_document_cnt, en_document_cnt, document_cnt;
+
+	// Translated documents are indexed and scored against in ranges of ids
+	// [ranges[i], ranges[i + 1]). Only more than one with --memory-limit, in
+	// which case the indexes are packed with scores in [min_score, max_score].
+	vector<size_t> ranges;
+	float min_score = 0, max_score = 0;
+
+	// Keeps the index file mapped for as long as df_table and ref_index point into it
+	unique_ptr<MappedFile> index_file;
 
-				unique_ptr<vector<DocumentRef>> ref_batch(new vector<DocumentRef>());
-				ref_batch->reserve(line_batch->size());
-			
-				for (Line const &line : *line_batch) {
-					Document doc{.id = line.n, .vocab = {}};
-					ReadDocument(line.str, doc, ngram_size);
+	if (vm.count("load-index")) {
+		run_stats.begin_phase("load_index");
+		index_file.reset(new MappedFile(vm["load-index"].as<std::string>()));
+		IndexReader reader(*index_file);
 
-					ref_batch->emplace_back();
-					calculate_tfidf(doc, ref_batch->back(), document_cnt, df, max_ngram_pruned);
+		if (vm.count("ngram_size") && ngram_size != reader.header().ngram_size) {
+			cerr << "Index " << index_file->path() << " was built with ngram size " << reader.header().ngram_size << endl;
+			return 1;
+		}
+
+		ngram_size = reader.header().ngram_size;
+		in_document_cnt = reader.header().in_document_cnt;
+		en_document_cnt = reader.header().en_document_cnt;
+		document_cnt = reader.header().document_cnt;
+		df_table = DFTable(reader);
+		ref_index = NGramIndex(reader);
+		ranges = {1, in_document_cnt + 1};
+
+		if (verbose)
+			cerr << "Loaded index of " << in_document_cnt << " documents with " << df_table.size() << " DF entries and "
+			     << ref_index.size() << " ngrams with " << ref_index.postings() << " postings from " << index_file->path()
+			     << (ref_index.packed() ? " (packed)" : "") << endl;
+
+		if (posting_bits && !ref_index.packed()) {
+			ref_index.pack(posting_bits);
+
+			if (verbose)
+				cerr << "Packed index into " << ref_index.memory_usage() / (1024 * 1024) << " MB" << endl;
+		}
+
+		run_stats.set("df", "ngrams", df_table.size());
+		add_index_stats(ref_index, run_stats);
+
+		// Without counting DF, nothing reads all English documents before
+		// scoring them, so only hashed documents of earlier runs are of use.
+		if (vm.count("english-tokens"))
+			use_hash_cache(vm["english-tokens"].as<std::string>(), false);
+	} else {
+		run_stats.begin_phase("df");
+
+		// Without English documents, which only happens when serving, the DF
+		// comes from the translated documents alone.
+		vector<string> df_paths;
+		if (vm.count("english-tokens"))
+			df_paths.push_back(vm["english-tokens"].as<std::string>());
+		df_paths.push_back(vm["translated-tokens"].as<std::string>());
+
+		// Only a pass over every document can write them
+		for (std::string const &path : df_paths)
+			use_hash_cache(path, df_sample_rate == 1);
+
+		if (approx_df_mb) {
+			vector<size_t> document_counts;
+			df_table = compute_approx_df(df_paths, document_counts, pool, hashed_documents, run_stats, ngram_size, min_ngram_cnt, max_ngram_cnt,
+				approx_df_mb * 1024 * 1024, df_sample_rate, verbose);
+			en_document_cnt = document_counts.size() > 1 ? document_counts.front() : 0;
+			in_document_cnt = document_counts.back();
+			document_cnt = in_document_cnt + en_document_cnt;
+
+			run_stats.set("df", "ngrams", df_table.size());
+		} else {
+			// Calculate the document frequency for terms. Starts a couple of threads
+			// that parse documents and keep a local hash table for counting. At the
+			// end these tables are merged into df.
+			unordered_map<NGram,size_t> df;
+			unordered_set<NGram> max_ngram_pruned;
+
+			// We'll use in_document_cnt later to reserve some space for the documents
+			// we want to keep in memory.
+			en_document_cnt = df_paths.size() > 1 ? compute_df(df, df_paths.front(), pool, hashed_documents, run_stats, ngram_size, min_ngram_cnt, batch_size, df_sample_rate, verbose) : 0;
+			in_document_cnt = compute_df(df, vm["translated-tokens"].as<std::string>(), pool, hashed_documents, run_stats, ngram_size, min_ngram_cnt, batch_size, df_sample_rate, verbose);
+			document_cnt = in_document_cnt + en_document_cnt;
+
+			// Prune the DF table, similar to what the Python implementation does. Note
+			// that compute_df already scaled the counts up by the sample rate, so the
+			// thresholds apply to the estimated number of documents.
+			size_t old_size = df.size();
+
+			for (auto it = df.begin(); it != df.end();) {
+				if (it->second < min_ngram_cnt) {
+					it = df.erase(it);
+				}
+				else if (it->second > max_ngram_cnt) {
+					max_ngram_pruned.insert(it->first);
+					it = df.erase(it);
+				} else {
+					// Keep it.
+					++it;
 				}
+			}
 
-				score_queue.push(std::move(ref_batch));
+			if (verbose) {
+				cerr << "Pruned " << old_size - df.size() << " (" << 100.0 - 100.0 * df.size() / old_size << "%) entries from DF\n"
+				     << "Very frequent ngram set is now " << max_ngram_pruned.size() << " long."
+				     << endl;
 			}
-		}));
 
-		// Function used to report the score. Implementation depends on whether
-		// we are doing print_all or not. Mutex is necessary for both cases,
-		// either for writing to top_scores or for printing to stdout.
-		function<void (float, size_t in_ref, size_t en_ref)> mark_score;
-		mutex mark_score_mutex;
+			// Freeze the pruned DF into a single table for calculate_tfidf
+			df_table = DFTable(df, max_ngram_pruned, document_cnt);
 
-		// Scores for all pairs (that meet the threshold). Only used with 
-		vector<DocumentPair> scored_pairs;
+			run_stats.set("df", "ngrams", df_table.size());
+			run_stats.set("df", "pruned_ngrams", max_ngram_pruned.size());
+		}
 
-		if (!print_all) {
-			mark_score = [&scored_pairs, &mark_score_mutex] (float score, size_t in_ref, size_t en_ref) {
-				unique_lock<mutex> lock(mark_score_mutex);
-				scored_pairs.push_back({score, in_ref, en_ref});
-			};
+		UTIL_THROW_IF(in_document_cnt > UINT32_MAX, util::Exception, "Too many documents in "
+			<< vm["translated-tokens"].as<std::string>() << " to index: " << in_document_cnt);
+
+		// Without a memory limit, or if the whole index fits in it, all
+		// translated documents go into a single index.
+		if (memory_limit) {
+			run_stats.begin_phase("partition");
+			ranges = partition_documents(vm["translated-tokens"].as<std::string>(), ngram_size, df_table, in_document_cnt, memory_limit * 1024 * 1024, pool, hashed_documents, run_stats, min_score, max_score);
+
+			if (verbose && ranges.size() > 2)
+				cerr << "Splitting " << in_document_cnt << " translated documents into " << ranges.size() - 1
+				     << " ranges to stay within " << memory_limit << " MB" << endl;
 		} else {
-			mark_score = [&mark_score_mutex](float score, size_t in_ref, size_t en_ref) {
-				unique_lock<mutex> lock(mark_score_mutex);
-				print_score(score, in_ref, en_ref);
-			};
+			ranges = {1, in_document_cnt + 1};
 		}
 
-		vector<thread> score_workers(start(n_score_threads, [&score_queue, &ref_index, &threshold, &mark_score](size_t) {
-			while (true) {
-				unique_ptr<vector<DocumentRef>> doc_ref_batch(score_queue.pop());
+		// Read translated documents & pre-calculate TF/DF for each of these documents
+		if (ranges.size() == 2) {
+			run_stats.begin_phase("index");
+			ref_index = build_index(vm["translated-tokens"].as<std::string>(), ngram_size, df_table, in_document_cnt, 1, in_document_cnt + 1, pool, hashed_documents, run_stats);
 
-				if (!doc_ref_batch)
-					break;
+			if (verbose)
+				cerr << "Read " << in_document_cnt << " documents into memory" << endl;
 
-				for (auto &doc_ref : *doc_ref_batch) {
-					unordered_map<size_t, float> ref_scores;
-					
-					for (auto const &word_score : doc_ref.wordvec) {
-						// Search ngram hash (uint64_t) in ref_index
-						auto it = ref_index.find(word_score.hash);
-						
-						if (it == ref_index.end())
-							continue;
-						
-						for (auto const &ref_score : it->second)
-							ref_scores[ref_score.doc_id] += word_score.tfidf * ref_score.tfidf;
-					}
+			if (verbose)
+				cerr << "Index has " << ref_index.size() << " ngrams with " << ref_index.postings() << " postings"
+				     << " in " << ref_index.memory_usage() / (1024 * 1024) << " MB" << endl;
 
-					for (auto const &ref : ref_scores)
-						if (ref.second >= threshold)
-							mark_score(ref.second, ref.first, doc_ref.id);
-				}
+			if (posting_bits) {
+				ref_index.pack(posting_bits);
+
+				if (verbose)
+					cerr << "Packed index into " << ref_index.memory_usage() / (1024 * 1024) << " MB" << endl;
 			}
-		}));
 
-		// Print output header
-		cout << "mt_doc_aligner_score\tidx_translated\tidx_trg" << endl;
+			add_index_stats(ref_index, run_stats);
+		}
+
+		if (vm.count("save-index")) {
+			run_stats.begin_phase("save_index");
+
+			IndexHeader header{};
+			header.ngram_size = ngram_size;
+			header.in_document_cnt = in_document_cnt;
+			header.en_document_cnt = en_document_cnt;
+			header.document_cnt = document_cnt;
+
+			IndexWriter writer(vm["save-index"].as<std::string>());
+			writer.write_header(header);
+			df_table.write(writer);
+			ref_index.write(writer);
+			writer.close();
+
+			if (verbose)
+				cerr << "Saved index to " << vm["save-index"].as<std::string>() << endl;
+		}
+	}
+
+	if (serving) {
+		run_stats.begin_phase("serve");
+
+		// A client that goes away should not take the server with it
+		signal(SIGPIPE, SIG_IGN);
+
+		AlignServer server(df_table, ref_index, in_document_cnt, ngram_size, threshold, print_all, pool);
+		std::string const &address = vm["serve"].as<std::string>();
+
+		if (verbose)
+			cerr << "Serving alignments against " << in_document_cnt << " translated documents on "
+			     << (address == "-" ? "stdin" : address) << endl;
+
+		if (address == "-")
+			server.serve(STDIN_FILENO, STDOUT_FILENO);
+		else
+			server.listen(address);
+
+		if (verbose)
+			cerr << "Aligned " << server.document_cnt() << " documents in " << server.request_cnt() << " requests" << endl;
+
+		run_stats.set("serve", "requests", server.request_cnt());
+		run_stats.set("serve", "documents", server.document_cnt());
+		run_stats.set("serve", "pairs", server.pair_cnt());
+		write_stats();
+		return 0;
+	}
+
+	// Calls fun with the index of each range of translated documents in turn.
+	// With a single range, that is the index built or loaded above. Otherwise
+	// the index of each range is built when it's needed, and freed after.
+	auto for_each_range = [&](std::function<void(NGramIndex const &)> fun) {
+		if (ranges.size() == 2) {
+			fun(ref_index);
+			return;
+		}
+
+		for (size_t range = 0; range + 1 < ranges.size(); ++range) {
+			run_stats.begin_phase("index");
+			NGramIndex range_index(build_index(vm["translated-tokens"].as<std::string>(), ngram_size, df_table, in_document_cnt, ranges[range], ranges[range + 1], pool, hashed_documents, run_stats));
+
+			if (posting_bits)
+				range_index.pack(posting_bits, min_score, max_score);
 
-		size_t read_cnt = queue_lines(vm["english-tokens"].as<std::string>(), read_queue);
+			if (verbose)
+				cerr << "Index of translated documents " << ranges[range] << " to " << ranges[range + 1] - 1
+				     << " has " << range_index.postings() << " postings in " << range_index.memory_usage() / (1024 * 1024) << " MB" << endl;
+
+			add_index_stats(range_index, run_stats);
+			fun(range_index);
+		}
+	};
+
+	// Only every shard_cnt-th English document is scored, starting at shard
+	auto in_shard = [&](size_t id) {
+		return (id - 1) % shard_cnt == shard - 1;
+	};
+
+	// Checks the number of English documents read while scoring
+	auto count_english = [&](size_t read_cnt) {
+		// A loaded index may be used with other English documents than the ones
+		// that went into its DF.
+		if (index_file) {
+			if (verbose && read_cnt != en_document_cnt)
+				cerr << "Note: read " << read_cnt << " documents, but the DF in the index was computed with "
+				     << en_document_cnt << " documents from the English side" << endl;
+
+			en_document_cnt = read_cnt;
+		}
 
 		UTIL_THROW_IF(read_cnt != en_document_cnt, util::Exception, "Line count changed"
 			<< " from " << en_document_cnt << " to " << read_cnt
 			<< " while reading " << vm["english-tokens"].as<std::string>() 
 			<< " in a second pass.");
+	};
 
-		// Tell all workers there is nothing left and wait for them to stop.
-		stop(read_queue, read_workers);
-		stop(score_queue, score_workers);
+	// Instead of picking the best pairs, write all of them for docalign-merge
+	if (vm.count("write-pairs")) {
+		vector<DocumentPair> pairs;
+		size_t read_cnt = 0;
 
-		if (!print_all) {
-			// Sort scores, best on top. Also sort on other properties to make
-			// it a consistent order, c.f. not depending on the processing order.
-			sort(scored_pairs.begin(), scored_pairs.end(), [](DocumentPair const &a, DocumentPair const &b) {
-				if (a.score != b.score)
-					return a.score > b.score;
+		for_each_range([&](NGramIndex const &index) {
+			run_stats.begin_phase("score");
+			read_cnt = collect_pairs(vm["english-tokens"].as<std::string>(), in_shard, ngram_size, df_table, index, in_document_cnt, threshold, pool, hashed_documents, run_stats, pairs);
+		});
 
-				if (a.in_idx != b.in_idx)
-					return a.in_idx > b.in_idx;
+		count_english(read_cnt);
 
-				return a.en_idx > b.en_idx;
-			});
+		run_stats.begin_phase("write_pairs");
+		sort(pairs.begin(), pairs.end(), &better_pair);
 
-			// Keep track of which documents have already been assigned
-			vector<bool> in_seen(in_document_cnt);
-			vector<bool> en_seen(en_document_cnt);
+		PairFileHeader header{};
+		header.shard = shard;
+		header.shard_cnt = shard_cnt;
+		header.in_document_cnt = in_document_cnt;
+		header.en_document_cnt = en_document_cnt;
+		write_pair_file(vm["write-pairs"].as<std::string>(), header, pairs);
 
-			// Also keep a quick tally on whether we've printed scores for
-			// every document, so we don't keep searching while in_seen or
-			// en_seen is completely filled.
-			size_t cnt = 0;
-			size_t document_cnt = min(in_document_cnt, en_document_cnt);
+		if (verbose)
+			cerr << "Wrote " << pairs.size() << " pairs to " << vm["write-pairs"].as<std::string>() << endl;
 
-			// Print output header
-			//cout << "mt_doc_aligner_score\tidx_translated\tidx_trg" << endl;
+		run_stats.set("pairs", "written", pairs.size());
+		write_stats();
+		return 0;
+	}
 
-			// For each pair (with score, sorted from good to bad)
-			for (DocumentPair const &pair : scored_pairs) {
-				// If either of the documents has already been printed, skip it.
-				if (in_seen[pair.in_idx - 1] || en_seen[pair.en_idx - 1])
-					continue;
+	// Start reading the other set of documents we match against and do the matching.
+	{
+		// Print output header
+		cout << "mt_doc_aligner_score\tidx_translated\tidx_trg" << endl;
 
-				print_score(pair.score, pair.in_idx, pair.en_idx);
-				in_seen[pair.in_idx - 1] = true;
-				en_seen[pair.en_idx - 1] = true;
+		// Best candidates of each English document, and the documents that had
+		// more candidates than that. Only used without print_all.
+		vector<DocumentPair> scored_pairs;
+		vector<size_t> truncated;
+		size_t read_cnt = 0;
+
+		for_each_range([&](NGramIndex const &index) {
+			run_stats.begin_phase("score");
+			read_cnt = score_documents(vm["english-tokens"].as<std::string>(), in_shard, ngram_size, df_table, index, in_document_cnt, threshold, print_all, pool, hashed_documents, run_stats, scored_pairs, truncated);
 
-				if (++cnt == document_cnt)
+			// Keep the best candidates of each document over all ranges so far
+			if (ranges.size() > 2 && !print_all)
+				merge_candidates(scored_pairs, truncated);
+		});
+
+		count_english(read_cnt);
+
+		if (!print_all) {
+			run_stats.set("pairs", "candidates", scored_pairs.size());
+			run_stats.set("pairs", "truncated_documents", truncated.size());
+
+			vector<bool> en_truncated(en_document_cnt);
+			for (size_t en_idx : truncated)
+				en_truncated[en_idx - 1] = true;
+
+			vector<size_t>().swap(truncated);
+
+			vector<DocumentPair> best_pairs;
+			vector<bool> en_seen;
+
+			// The best pairs are the same as with all candidates, unless one of
+			// the documents that had candidates cut off is left without a match.
+			// All of its kept candidates are better than the cut off ones, so it
+			// was still free when their turn would have come. If one of their
+			// translated documents was free too, that pair would have been picked,
+			// and that translated document may now have a worse pair instead.
+			// This can happen even when every translated document has a match, so
+			// rescore those documents with all their candidates and try again.
+			while (true) {
+				run_stats.begin_phase("select");
+				best_pairs = select_best_pairs(scored_pairs, in_document_cnt, en_document_cnt, en_seen);
+
+				vector<bool> rescore(en_document_cnt);
+				size_t rescore_cnt = 0;
+
+				for (size_t i = 0; i < en_document_cnt; ++i) {
+					if (en_truncated[i] && !en_seen[i]) {
+						rescore[i] = true;
+						en_truncated[i] = false;
+						++rescore_cnt;
+					}
+				}
+
+				if (rescore_cnt == 0)
 					break;
+
+				if (verbose)
+					cerr << "Rescoring " << rescore_cnt << " documents with all their candidates" << endl;
+
+				scored_pairs.erase(remove_if(scored_pairs.begin(), scored_pairs.end(), [&rescore](DocumentPair const &pair) {
+					return rescore[pair.en_idx - 1];
+				}), scored_pairs.end());
+
+				run_stats.add("pairs", "rescored_documents", rescore_cnt);
+
+				for_each_range([&](NGramIndex const &index) {
+					run_stats.begin_phase("rescore");
+					collect_pairs(vm["english-tokens"].as<std::string>(), [&rescore](size_t id) {
+						return id <= rescore.size() && rescore[id - 1];
+					}, ngram_size, df_table, index, in_document_cnt, threshold, pool, hashed_documents, run_stats, scored_pairs);
+				});
 			}
-		}
 
-		if (verbose)
-			cerr << "Read queue performance (Note: blocks when score queue fills up):\n" << read_queue.performance()
-			     << "Score queue performance:\n" << score_queue.performance();
+			run_stats.begin_phase("output");
+
+			for (DocumentPair const &pair : best_pairs)
+				print_score(pair.score, pair.in_idx, pair.en_idx);
+
+			run_stats.set("pairs", "selected", best_pairs.size());
+
+			if (verbose)
+				cerr << "Selected " << best_pairs.size() << " pairs from " << scored_pairs.size() << " candidate pairs" << endl;
+		}
 	}
 
+	write_stats();
 	return 0;
 }
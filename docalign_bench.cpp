@@ -0,0 +1,455 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <sys/stat.h>
+#include <boost/program_options.hpp>
+#include <zlib.h>
+#include "util/exception.hh"
+#include "src/base64.h"
+#include "src/df_table.h"
+#include "src/document.h"
+#include "src/document_pair.h"
+#include "src/ngram.h"
+#include "src/ngram_counter.h"
+#include "src/ngram_index.h"
+#include "src/scorer.h"
+#include "src/thread_pool.h"
+
+
+using namespace bitextor;
+using namespace std;
+
+namespace po = boost::program_options;
+
+/**
+ * Settings of the synthetic corpus. English documents draw their words from a
+ * Zipfian distribution over the vocabulary. A share of them has a translation:
+ * a copy with some of the words replaced. The translated documents are those
+ * translations plus some unrelated documents, in random order.
+ */
+struct CorpusOptions {
+	size_t documents = 10000;
+	size_t vocabulary = 50000;
+	double zipf = 1.0;
+	size_t min_length = 20;
+	size_t max_length = 400;
+	double aligned = 0.7;
+	double noise = 0.3;
+	double unrelated = 0.3;
+	size_t words_per_line = 15;
+	uint64_t seed = 1;
+};
+
+struct Corpus {
+	// Base64 encoded documents, one per line in the files docalign reads
+	vector<string> translated;
+	vector<string> english;
+};
+
+/**
+ * Draws word ids with P(rank r) proportional to 1 / r^s.
+ */
+class ZipfDistribution {
+public:
+	ZipfDistribution(size_t size, double s)
+	: cdf_(size) {
+		double sum = 0;
+		for (size_t i = 0; i < size; ++i)
+			cdf_[i] = sum += 1.0 / pow(i + 1, s);
+
+		for (double &p : cdf_)
+			p /= sum;
+	}
+
+	template <typename Generator> size_t operator()(Generator &generator) {
+		double p = uniform_(generator);
+		return min(size_t(lower_bound(cdf_.begin(), cdf_.end(), p) - cdf_.begin()), cdf_.size() - 1);
+	}
+
+private:
+	vector<double> cdf_;
+	uniform_real_distribution<double> uniform_;
+};
+
+// Spells out word id as a lowercase word, so frequent words are short.
+string word(size_t id)
+{
+	string out;
+	do {
+		out.push_back('a' + id % 26);
+		id /= 26;
+	} while (id > 0);
+	return out;
+}
+
+string encode(vector<size_t> const &words, vector<string> const &spelling, size_t words_per_line)
+{
+	string text;
+	for (size_t i = 0; i < words.size(); ++i) {
+		if (i > 0)
+			text.push_back(i % words_per_line == 0 ? '\n' : ' ');
+		text += spelling[words[i]];
+	}
+
+	string encoded;
+	base64_encode(text, encoded);
+	return encoded;
+}
+
+Corpus generate_corpus(CorpusOptions const &options)
+{
+	mt19937_64 generator(options.seed);
+	ZipfDistribution zipf(options.vocabulary, options.zipf);
+	uniform_int_distribution<size_t> length(options.min_length, options.max_length);
+	bernoulli_distribution is_aligned(options.aligned), is_noise(options.noise);
+
+	vector<string> spelling(options.vocabulary);
+	for (size_t i = 0; i < options.vocabulary; ++i)
+		spelling[i] = word(i);
+
+	auto document = [&]() {
+		vector<size_t> words(length(generator));
+		for (size_t &id : words)
+			id = zipf(generator);
+		return words;
+	};
+
+	Corpus corpus;
+	corpus.english.reserve(options.documents);
+
+	for (size_t i = 0; i < options.documents; ++i) {
+		vector<size_t> words(document());
+		corpus.english.push_back(encode(words, spelling, options.words_per_line));
+
+		if (!is_aligned(generator))
+			continue;
+
+		for (size_t &id : words)
+			if (is_noise(generator))
+				id = zipf(generator);
+
+		corpus.translated.push_back(encode(words, spelling, options.words_per_line));
+	}
+
+	for (size_t i = 0; i < size_t(options.documents * options.unrelated); ++i)
+		corpus.translated.push_back(encode(document(), spelling, options.words_per_line));
+
+	shuffle(corpus.translated.begin(), corpus.translated.end(), generator);
+	return corpus;
+}
+
+void write_lines(string const &path, vector<string> const &lines, bool gzip)
+{
+	if (gzip) {
+		gzFile file = gzopen(path.c_str(), "wb");
+		UTIL_THROW_IF(!file, util::ErrnoException, "Could not open " << path);
+
+		for (string const &line : lines) {
+			UTIL_THROW_IF(gzwrite(file, line.data(), line.size()) != int(line.size()) || gzputc(file, '\n') != '\n',
+				util::Exception, "Could not write to " << path);
+		}
+
+		UTIL_THROW_IF(gzclose(file) != Z_OK, util::Exception, "Could not write to " << path);
+	} else {
+		ofstream file(path);
+		for (string const &line : lines)
+			file << line << '\n';
+		UTIL_THROW_IF(!file, util::ErrnoException, "Could not write to " << path);
+	}
+}
+
+/**
+ * Throughput of one stage: how long it took at best over all repetitions,
+ * and how many items and bytes it got through in that time.
+ */
+struct StageResult {
+	string name;
+	double seconds;
+	size_t items;
+	size_t bytes;
+};
+
+/**
+ * Runs the stage `repeat` times and keeps the fastest run. setup() runs
+ * before every repetition, untimed, to reset whatever the stage produces.
+ */
+StageResult time_stage(string const &name, size_t repeat, size_t items, size_t bytes, function<void()> setup, function<void()> stage)
+{
+	double best = numeric_limits<double>::max();
+
+	for (size_t i = 0; i < repeat; ++i) {
+		setup();
+		auto start = chrono::steady_clock::now();
+		stage();
+		best = min(best, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+	}
+
+	cerr << name << ": " << fixed << setprecision(4) << best << "s" << endl;
+	return StageResult{name, best, items, bytes};
+}
+
+size_t total_size(vector<string> const &lines)
+{
+	size_t size = 0;
+	for (string const &line : lines)
+		size += line.size();
+	return size;
+}
+
+void print_results(ostream &out, CorpusOptions const &options, Corpus const &corpus, size_t ngram_size, vector<StageResult> const &results)
+{
+	out << fixed << "{\n"
+	    << "  \"corpus\": {"
+	    << "\"documents\": " << options.documents
+	    << ", \"vocabulary\": " << options.vocabulary
+	    << ", \"zipf\": " << options.zipf
+	    << ", \"seed\": " << options.seed
+	    << ", \"translated\": " << corpus.translated.size()
+	    << ", \"english\": " << corpus.english.size()
+	    << ", \"bytes\": " << total_size(corpus.translated) + total_size(corpus.english)
+	    << ", \"ngram_size\": " << ngram_size
+	    << "},\n"
+	    << "  \"stages\": [\n";
+
+	for (size_t i = 0; i < results.size(); ++i) {
+		StageResult const &result = results[i];
+		out << "    {\"name\": \"" << result.name << "\""
+		    << ", \"seconds\": " << setprecision(6) << result.seconds
+		    << ", \"items\": " << result.items
+		    << ", \"bytes\": " << result.bytes
+		    << ", \"items_per_second\": " << setprecision(1) << result.items / result.seconds
+		    << ", \"mb_per_second\": " << setprecision(3) << result.bytes / result.seconds / (1024 * 1024)
+		    << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+
+	out << "  ]\n"
+	    << "}" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	CorpusOptions options;
+
+	size_t ngram_size = 2;
+
+	size_t min_ngram_cnt = 2;
+
+	size_t max_ngram_cnt = 1000;
+
+	float threshold = 0.1;
+
+	size_t repeat = 3;
+
+	unsigned int n_threads = 1;
+
+	bool gzip = false;
+
+	po::options_description generic_desc("Options");
+	generic_desc.add_options()
+		("help", "produce help message")
+		("documents", po::value<size_t>(&options.documents), "number of English documents (default: 10000)")
+		("vocabulary", po::value<size_t>(&options.vocabulary), "number of distinct words (default: 50000)")
+		("zipf", po::value<double>(&options.zipf), "exponent of the Zipfian word distribution (default: 1.0)")
+		("min-length", po::value<size_t>(&options.min_length), "minimal number of words in a document (default: 20)")
+		("max-length", po::value<size_t>(&options.max_length), "maximal number of words in a document (default: 400)")
+		("aligned", po::value<double>(&options.aligned), "share of English documents that have a translation (default: 0.7)")
+		("noise", po::value<double>(&options.noise), "share of words replaced in a translation (default: 0.3)")
+		("unrelated", po::value<double>(&options.unrelated), "unrelated translated documents, relative to the English ones (default: 0.3)")
+		("seed", po::value<uint64_t>(&options.seed), "random seed (default: 1)")
+		("write-corpus", po::value<string>(), "write the corpus to translated.b64 and english.b64 in this directory, and stop")
+		("gzip", po::bool_switch(&gzip), "gzip the files written by --write-corpus")
+		("ngram_size,n", po::value<size_t>(&ngram_size), "ngram size (default: 2)")
+		("min_count", po::value<size_t>(&min_ngram_cnt), "minimal number of documents an ngram can appear in to be included in DF (default: 2)")
+		("max_count", po::value<size_t>(&max_ngram_cnt), "maximum number of documents for ngram to to appear in (default: 1000)")
+		("threshold", po::value<float>(&threshold), "set score threshold (default: 0.1)")
+		("jobs,j", po::value<unsigned int>(&n_threads), "number of threads for building the index (default: 1)")
+		("repeat", po::value<size_t>(&repeat), "run each stage this many times and keep the fastest (default: 3)")
+		("output,o", po::value<string>(), "write the results as JSON to this file instead of stdout");
+
+	po::variables_map vm;
+
+	try {
+		po::store(po::command_line_parser(argc, argv).options(generic_desc).run(), vm);
+		po::notify(vm);
+	} catch (const po::error &exception) {
+		cerr << exception.what() << endl;
+		return 1;
+	}
+
+	if (vm.count("help")) {
+		cout << "Usage: " << argv[0] << " [OPTIONS]\n\n"
+		     << "Generates a synthetic parallel corpus, and measures the throughput of each\n"
+		     << "stage of docalign on it separately.\n\n"
+		     << generic_desc << endl;
+		return 1;
+	}
+
+	if (options.documents < 1 || options.vocabulary < 1 || options.min_length < 1 || options.min_length > options.max_length) {
+		cerr << "--documents and --vocabulary need to be at least 1, and --min-length between 1 and --max-length" << endl;
+		return 1;
+	}
+
+	if (ngram_size < 1 || ngram_size > NGramIter::kMaxNGramSize) {
+		cerr << "--ngram_size needs to be between 1 and " << NGramIter::kMaxNGramSize << endl;
+		return 1;
+	}
+
+	if (repeat < 1) {
+		cerr << "--repeat needs to be 1 or higher" << endl;
+		return 1;
+	}
+
+	Corpus corpus(generate_corpus(options));
+
+	if (vm.count("write-corpus")) {
+		string dir = vm["write-corpus"].as<string>();
+		mkdir(dir.c_str(), 0777);
+
+		string suffix = gzip ? ".b64.gz" : ".b64";
+		write_lines(dir + "/translated" + suffix, corpus.translated, gzip);
+		write_lines(dir + "/english" + suffix, corpus.english, gzip);
+		return 0;
+	}
+
+	// All documents, translated ones first so their position is their id - 1,
+	// like in docalign.
+	vector<string> encoded(corpus.translated);
+	encoded.insert(encoded.end(), corpus.english.begin(), corpus.english.end());
+
+	size_t in_document_cnt = corpus.translated.size();
+	size_t document_cnt = encoded.size();
+	size_t encoded_bytes = total_size(encoded);
+
+	vector<StageResult> results;
+
+	// Output of each stage, which is the input of the next
+	vector<string> decoded(document_cnt);
+	vector<Document> documents(document_cnt);
+	DFTable df_table;
+	vector<DocumentRef> document_refs(document_cnt);
+	NGramIndex ref_index;
+	vector<DocumentPair> pairs;
+	vector<DocumentPair> best_pairs;
+
+	auto nothing = []() {};
+
+	results.push_back(time_stage("base64_decode", repeat, document_cnt, encoded_bytes, nothing, [&]() {
+		for (size_t i = 0; i < document_cnt; ++i)
+			base64_decode(encoded[i], decoded[i]);
+	}));
+
+	size_t ngram_cnt = 0;
+
+	results.push_back(time_stage("ngram_iter", repeat, 0, total_size(decoded), [&]() {
+		ngram_cnt = 0;
+	}, [&]() {
+		for (string const &text : decoded)
+			for (NGramIter ngram_it(text, ngram_size); ngram_it; ++ngram_it)
+				++ngram_cnt;
+	}));
+
+	results.back().items = ngram_cnt;
+
+	results.push_back(time_stage("read_document", repeat, document_cnt, encoded_bytes, nothing, [&]() {
+		DocumentReader reader(ngram_size);
+		for (size_t i = 0; i < document_cnt; ++i) {
+			documents[i].id = i + 1;
+			reader.read(encoded[i], documents[i]);
+		}
+	}));
+
+	// Counting and pruning like docalign, on the documents read above
+	results.push_back(time_stage("compute_df", repeat, document_cnt, 0, nothing, [&]() {
+		vector<NGramCounter> counters;
+		counters.emplace_back(size_t(50000000));
+
+		for (Document const &document : documents)
+			for (WordCount const &entry : document.vocab)
+				counters.front().add(entry.hash);
+
+		unordered_map<NGram,size_t> df;
+		unordered_set<NGram> max_ngram_pruned;
+
+		merge_counts(counters, [&](NGramCount const &entry) {
+			if (entry.count > max_ngram_cnt)
+				max_ngram_pruned.insert(entry.ngram);
+			else if (entry.count >= min_ngram_cnt)
+				df[entry.ngram] = entry.count;
+		});
+
+		df_table = DFTable(df, max_ngram_pruned, document_cnt);
+	}));
+
+	results.push_back(time_stage("calculate_tfidf", repeat, document_cnt, 0, nothing, [&]() {
+		for (size_t i = 0; i < document_cnt; ++i)
+			calculate_tfidf(documents[i], document_refs[i], df_table);
+	}));
+
+	size_t posting_cnt = 0;
+	for (size_t i = 0; i < in_document_cnt; ++i)
+		posting_cnt += document_refs[i].wordvec.size();
+
+	results.push_back(time_stage("build_index", repeat, posting_cnt, 0, nothing, [&]() {
+		ThreadPool pool(n_threads, n_threads * 32);
+		IndexBuilder builder(pool.size());
+
+		for (size_t i = 0; i < in_document_cnt; ++i)
+			for (WordScore const &entry : document_refs[i].wordvec)
+				builder.add(0, IndexEntry{entry.hash, uint32_t(i + 1), entry.tfidf});
+
+		ref_index = NGramIndex(std::move(builder), pool);
+	}));
+
+	results.push_back(time_stage("score", repeat, document_cnt - in_document_cnt, 0, [&]() {
+		pairs.clear();
+	}, [&]() {
+		Scorer scorer(ref_index, in_document_cnt, threshold);
+
+		for (size_t i = in_document_cnt; i < document_cnt; ++i) {
+			scorer.score(document_refs[i], [&](size_t in_idx, float score) {
+				if (score >= threshold)
+					pairs.push_back(DocumentPair{score, in_idx, i + 1 - in_document_cnt});
+			});
+		}
+	}));
+
+	vector<DocumentPair> scored_pairs(pairs);
+
+	results.push_back(time_stage("select_best", repeat, pairs.size(), 0, [&]() {
+		pairs = scored_pairs;
+		best_pairs.clear();
+	}, [&]() {
+		sort(pairs.begin(), pairs.end(), &better_pair);
+
+		PairSelector selector(in_document_cnt, document_cnt - in_document_cnt);
+		for (DocumentPair const &pair : pairs) {
+			if (selector.done())
+				break;
+
+			if (selector.add(pair))
+				best_pairs.push_back(pair);
+		}
+	}));
+
+	cerr << "Found " << best_pairs.size() << " pairs among " << scored_pairs.size() << " that meet the threshold" << endl;
+
+	if (vm.count("output")) {
+		ofstream out(vm["output"].as<string>());
+		print_results(out, options, corpus, ngram_size, results);
+		UTIL_THROW_IF(!out, util::ErrnoException, "Could not write to " << vm["output"].as<string>());
+	} else {
+		print_results(cout, options, corpus, ngram_size, results);
+	}
+
+	return 0;
+}
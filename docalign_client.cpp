@@ -0,0 +1,102 @@
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "util/file.hh"
+#include "util/file_piece.hh"
+#include "src/serve_protocol.h"
+
+
+using namespace bitextor;
+using namespace std;
+
+int usage(char *progname) {
+	cout << "Usage: " << progname << " [-b BATCH] SOCKET [ENGLISH-TOKENS]\n"
+	        "\n"
+	        "Sends the documents in ENGLISH-TOKENS, or stdin, to `docalign --serve SOCKET`\n"
+	        "and prints the pairs it finds like docalign does, with the English documents\n"
+	        "numbered by their line in the input. With -b, sends BATCH documents per\n"
+	        "request, each of which gets its own best pairs. Otherwise all of them go in\n"
+	        "a single request.\n";
+	return 1;
+}
+
+/**
+ * Sends a request with documents and prints the pairs of its response, with
+ * the English documents numbered from `first`. Returns false if the server
+ * did not answer.
+ */
+bool align(LineConnection &connection, vector<string> const &documents, size_t first) {
+	vector<string> lines;
+	string error;
+
+	if (!write_request(connection, documents) || !read_response(connection, lines, error)) {
+		cerr << "Server did not align the documents" << (error.empty() ? "" : ": " + error) << endl;
+		return false;
+	}
+
+	// Each line is score, translated index and English index, separated by tabs
+	for (string const &line : lines) {
+		size_t tab = line.rfind('\t');
+		cout << line.substr(0, tab + 1) << strtoull(line.c_str() + tab + 1, nullptr, 10) + first - 1 << '\n';
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	size_t batch_size = 0;
+	vector<string> args;
+
+	for (int i = 1; i < argc; ++i) {
+		string arg(argv[i]);
+
+		if (arg == "-h" || arg == "--help")
+			return usage(argv[0]);
+
+		if (arg == "-b" && i + 1 < argc) {
+			batch_size = strtoull(argv[++i], nullptr, 10);
+			if (batch_size == 0 || batch_size > kMaxRequestDocuments) {
+				cerr << "-b needs a number of documents between 1 and " << kMaxRequestDocuments << endl;
+				return 1;
+			}
+			continue;
+		}
+
+		args.push_back(arg);
+	}
+
+	if (args.empty() || args.size() > 2)
+		return usage(argv[0]);
+
+	if (batch_size == 0)
+		batch_size = kMaxRequestDocuments;
+
+	util::scoped_fd socket(connect_unix(args[0]));
+	LineConnection connection(socket.get(), socket.get());
+
+	unique_ptr<util::FilePiece> in(args.size() > 1 ? new util::FilePiece(args[1].c_str()) : new util::FilePiece(0, "stdin"));
+
+	cout << "mt_doc_aligner_score\tidx_translated\tidx_trg" << endl;
+
+	vector<string> documents;
+	size_t first = 1;
+
+	for (util::StringPiece line : *in) {
+		documents.emplace_back(line.data(), line.size());
+
+		if (documents.size() == batch_size) {
+			if (!align(connection, documents, first))
+				return 1;
+
+			first += documents.size();
+			documents.clear();
+		}
+	}
+
+	if ((!documents.empty() || first == 1) && !align(connection, documents, first))
+		return 1;
+
+	return 0;
+}
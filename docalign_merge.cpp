@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+#include "src/document_pair.h"
+#include "src/pair_file.h"
+
+
+using namespace bitextor;
+using namespace std;
+
+/**
+ * Position in one of the pair files, which are each sorted from best to
+ * worst pair.
+ */
+struct Cursor {
+	DocumentPair pair;
+	StoredPair const *next;
+	StoredPair const *end;
+};
+
+inline DocumentPair unpack(StoredPair const &stored) {
+	return DocumentPair{stored.score, stored.in_idx, stored.en_idx};
+}
+
+int usage(char *progname) {
+	cout << "Usage: " << progname << " PAIRS...\n"
+	        "\n"
+	        "Merges the pair files written by `docalign --shard I/N --write-pairs PAIRS`\n"
+	        "for all shards I of N, and prints the best pairs like docalign does.\n";
+	return 1;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2 || string(argv[1]) == "-h" || string(argv[1]) == "--help")
+		return usage(argv[0]);
+
+	vector<unique_ptr<PairFile>> files;
+	for (int i = 1; i < argc; ++i)
+		files.emplace_back(new PairFile(argv[i]));
+
+	// All files need to be shards of the same alignment, and together cover
+	// all of it.
+	PairFileHeader const &first = files.front()->header();
+	vector<bool> shard_seen(first.shard_cnt);
+
+	for (auto const &file : files) {
+		PairFileHeader const &header = file->header();
+
+		if (header.shard_cnt != first.shard_cnt
+			|| header.in_document_cnt != first.in_document_cnt
+			|| header.en_document_cnt != first.en_document_cnt) {
+			cerr << file->path() << " is not part of the same alignment as " << files.front()->path() << endl;
+			return 1;
+		}
+
+		if (shard_seen[header.shard - 1]) {
+			cerr << "Shard " << header.shard << "/" << header.shard_cnt << " is given more than once" << endl;
+			return 1;
+		}
+
+		shard_seen[header.shard - 1] = true;
+	}
+
+	if (files.size() != first.shard_cnt) {
+		cerr << "Got " << files.size() << " of " << first.shard_cnt << " shards" << endl;
+		return 1;
+	}
+
+	// Merge the files, best pair on top of the heap
+	auto worse = [](Cursor const &a, Cursor const &b) {
+		return better_pair(b.pair, a.pair);
+	};
+
+	priority_queue<Cursor, vector<Cursor>, decltype(worse)> heap(worse);
+
+	for (auto const &file : files)
+		if (file->begin() != file->end())
+			heap.push(Cursor{unpack(*file->begin()), file->begin() + 1, file->end()});
+
+	PairSelector selector(first.in_document_cnt, first.en_document_cnt);
+
+	cout << "mt_doc_aligner_score\tidx_translated\tidx_trg" << endl;
+
+	while (!heap.empty() && !selector.done()) {
+		Cursor cursor(heap.top());
+		heap.pop();
+
+		if (cursor.pair.in_idx < 1 || cursor.pair.in_idx > first.in_document_cnt
+			|| cursor.pair.en_idx < 1 || cursor.pair.en_idx > first.en_document_cnt) {
+			cerr << "Pair of documents " << cursor.pair.in_idx << " and " << cursor.pair.en_idx << " is out of range" << endl;
+			return 1;
+		}
+
+		if (selector.add(cursor.pair))
+			print_score(cursor.pair.score, cursor.pair.in_idx, cursor.pair.en_idx);
+
+		if (cursor.next != cursor.end) {
+			cursor.pair = unpack(*cursor.next++);
+			heap.push(cursor);
+		}
+	}
+
+	return 0;
+}
@@ -1,11 +1,11 @@
 #include <algorithm>
 #include <vector>
 #include <iostream>
-#include <unordered_set>
 #include <sstream>
 #include <memory>
 #include "util/file_piece.hh"
 #include "src/base64.h"
+#include "src/line_index.h"
 
 
 using namespace bitextor;
@@ -36,6 +36,12 @@ ostream &operator<<(ostream &out, Row const &row) {
 
 typedef vector<unique_ptr<util::FilePiece>> FileSet;
 
+typedef vector<unique_ptr<LineIndex>> IndexedFileSet;
+
+// Joins handled at a time. The left rows of a batch are all that is kept in
+// memory of the left side.
+constexpr size_t kBatchSize = 1 << 16;
+
 bool skip_rows(FileSet &files, size_t n) {
 	util::StringPiece line;
 
@@ -62,6 +68,14 @@ bool read_row(FileSet &files, Row &row) {
 	return true;
 }
 
+// Reads row `index`, counting from 1 like docalign, from the left files
+void read_row(IndexedFileSet &files, size_t index, Row &row) {
+	row.cells.resize(files.size());
+
+	for (size_t i = 0; i < files.size(); ++i)
+		files[i]->read(index - 1, row.cells[i]);
+}
+
 enum Source {
 	LEFT,
 	RIGHT,
@@ -70,7 +84,7 @@ enum Source {
 };
 
 int usage(char *progname) {
-	cout << "Usage: " << progname << " [ -l filename | -r filename | -li | -ri ] ...\n"
+	cout << "Usage: " << progname << " [ -c dir ] [ -l filename | -r filename | -li | -ri ] ...\n"
 	        "Input via stdin: <left index> \"\\t\" <right index> \"\\n\"\n"
 	        "\n"
 	        "This program joins rows from two sets of files into tab-separated output.\n"
@@ -81,8 +95,17 @@ int usage(char *progname) {
 	        "  -li   Print the left index\n"
 	        "  -ri   Print the right index\n"
 	        "\n"
+	        "Other options:\n"
+	        "  -c    Keep the line indexes of the left files in this directory\n"
+	        "\n"
 	        "The order of the columns in the output is the same as the order of the\n"
-	        "arguments given to the program.\n";
+	        "arguments given to the program.\n"
+	        "\n"
+	        "Right files are read from start to end. Left rows are looked up through\n"
+	        "an index of where each line starts, which for plain and BGZF files can\n"
+	        "be kept with -c for the next time. Left files compressed otherwise, like\n"
+	        "gzip or xz, are decompressed in full to a temporary file on every run.\n"
+	        "Compress large left files with bgzip to avoid that.\n";
 	return 127;
 }
 
@@ -93,12 +116,22 @@ int main(int argc, char *argv[]) {
 	// Open the files on the left and right side of the join. Keep track of
 	// which file is on the left and on the right side, but also of the order
 	// of the arguments as this will dictate the order of the output.
-	FileSet left_files, right_files;
+	IndexedFileSet left_files;
+	FileSet right_files;
 	vector<Source> order;
 	Source side = LEFT;
-	FileSet *files[]{&left_files, &right_files};
+
+	// Left files are opened once all arguments are known, since -c might
+	// come after them.
+	vector<string> left_paths;
+	string cache_dir;
+
 	for (int pos = 1; pos < argc; ++pos) {
-		if (string(argv[pos]) == "-l")
+		if (string(argv[pos]) == "-c") {
+			if (++pos == argc)
+				return usage(argv[0]);
+			cache_dir = argv[pos];
+		} else if (string(argv[pos]) == "-l")
 			side = LEFT;
 		else if (string(argv[pos]) == "-r")
 			side = RIGHT;
@@ -107,21 +140,34 @@ int main(int argc, char *argv[]) {
 		else if (string(argv[pos]) == "-ri")
 			order.push_back(RIGHT_INDEX);
 		else {
-			files[side]->emplace_back(new util::FilePiece(argv[pos]));
+			if (side == LEFT)
+				left_paths.push_back(argv[pos]);
+			else
+				right_files.emplace_back(new util::FilePiece(argv[pos]));
 			order.push_back(side);
 		}
 	}
 
+	for (string const &path : left_paths)
+		left_files.emplace_back(new LineIndex(path, cache_dir));
+
+	// Rows on the left side, as far as all left files have them
+	size_t left_row_cnt = SIZE_MAX;
+	for (auto const &file : left_files)
+		left_row_cnt = min(left_row_cnt, file->size());
+
 	// Read our joins into memory
 	vector<Join> joins;
 	string line;
-	std::unordered_set<int> left_indexes;
 	while (getline(cin, line)) {
 		istringstream iline(line);
 		Join join;
-		if (iline >> join.left_index >> join.right_index){
+		if (iline >> join.left_index >> join.right_index) {
+			if (!left_files.empty() && (join.left_index < 1 || join.left_index > left_row_cnt)) {
+				cerr << "Left index " << join.left_index << " outside of range " << left_row_cnt << endl;
+				return 2;
+			}
 			joins.push_back(join);
-			left_indexes.insert (int(join.left_index));
 		}
 	}
 
@@ -131,19 +177,10 @@ int main(int argc, char *argv[]) {
 		return left.right_index < right.right_index;
 	});
 
-	// Read all of the left in memory
+	// Left rows of the current batch, in order of their index
+	vector<size_t> left_indexes;
 	vector<Row> left_rows;
-	size_t left_index = 0; // the indices used by docalign start at 1
-	while (true) {
-		Row row;
-		left_index++;
-		if (!read_row(left_files, row))
-			break;
-		if (left_indexes.count(left_index) >= 1)
-			left_rows.push_back(move(row));
-		else
-			left_rows.push_back(Row());
-	}
+	auto batch_end = joins.begin();
 
 	// For all joins (sorted by their right index) start reading through right
 	// and every time we encounter one that we need we print left + right.
@@ -153,6 +190,23 @@ int main(int argc, char *argv[]) {
 		// Assume we sorted correctly and we read from 1 to n without jumps...
 		assert(join_it->right_index >= right_index);
 
+		// Fetch the left rows of the next batch of joins, in the order they
+		// are in the files so the reads move forward through them.
+		if (join_it == batch_end) {
+			batch_end = joins.end() - join_it > ptrdiff_t(kBatchSize) ? join_it + kBatchSize : joins.end();
+
+			left_indexes.clear();
+			for (auto it = join_it; it != batch_end; ++it)
+				left_indexes.push_back(it->left_index);
+
+			sort(left_indexes.begin(), left_indexes.end());
+			left_indexes.erase(unique(left_indexes.begin(), left_indexes.end()), left_indexes.end());
+
+			left_rows.resize(left_indexes.size());
+			for (size_t i = 0; i < left_indexes.size(); ++i)
+				read_row(left_files, left_indexes[i], left_rows[i]);
+		}
+
 		// While our index is still far off, skip rows
 		if (right_index < join_it->right_index - 1) {
 			if (!skip_rows(right_files, (join_it->right_index - 1) - right_index)) {
@@ -171,11 +225,7 @@ int main(int argc, char *argv[]) {
 			++right_index;
 		}
 
-		// Our left index is outside of what's in memory? Sad!
-		if (join_it->left_index - 1 > left_rows.size()) {
-			cerr << "Left index " << join_it->left_index << " outside of range " << left_rows.size() << endl;
-			return 2;
-		}
+		Row const &left_row = left_rows[lower_bound(left_indexes.begin(), left_indexes.end(), join_it->left_index) - left_indexes.begin()];
 
 		// Print the columns in the order in which the input files were given to the program
 		for (size_t i = 0, l = 0, r = 0; i < order.size(); ++i) {
@@ -184,7 +234,7 @@ int main(int argc, char *argv[]) {
 			
 			switch (order[i]) {
 				case LEFT:
-					cout << left_rows[join_it->left_index - 1].cells[l++];
+					cout << left_row.cells[l++];
 					break;
 				case RIGHT:
 					cout << right_row.cells[r++];
@@ -0,0 +1,270 @@
+#include "align_server.h"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <exception>
+#include <list>
+#include <thread>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "util/exception.hh"
+#include "util/file.hh"
+#include "serve_protocol.h"
+
+using namespace std;
+
+namespace bitextor {
+
+namespace {
+
+// Write end of the stop pipe of the server that is listening, for the
+// signal handler
+volatile sig_atomic_t signal_pipe = -1;
+
+extern "C" void stop_on_signal(int) {
+	if (signal_pipe != -1) {
+		ssize_t written = write(signal_pipe, "s", 1);
+		(void) written;
+	}
+}
+
+/**
+ * Connection to a client, served on a thread of its own. Says when it's done
+ * so the thread can be joined.
+ */
+struct Connection {
+	explicit Connection(int fd)
+	: fd(fd),
+	  done(false) {
+		//
+	}
+
+	util::scoped_fd fd;
+	thread worker;
+	atomic<bool> done;
+};
+
+} // namespace
+
+constexpr size_t AlignServer::kBatchSize;
+
+AlignServer::AlignServer(DFTable const &df, NGramIndex const &index, size_t in_document_cnt, size_t ngram_size, float threshold, bool print_all, ThreadPool &pool)
+: df_(df),
+  index_(index),
+  in_document_cnt_(in_document_cnt),
+  threshold_(threshold),
+  print_all_(print_all),
+  pool_(pool),
+  request_cnt_(0),
+  document_cnt_(0),
+  pair_cnt_(0) {
+	workspaces_.reserve(pool.size());
+	for (size_t i = 0; i < pool.size(); ++i)
+		workspaces_.emplace_back(ngram_size);
+
+	UTIL_THROW_IF(pipe(stop_pipe_) == -1, util::ErrnoException, "Could not create pipe");
+}
+
+AlignServer::~AlignServer() {
+	close(stop_pipe_[0]);
+	close(stop_pipe_[1]);
+}
+
+vector<DocumentPair> AlignServer::align(vector<string> const &documents) {
+	size_t batch_cnt = (documents.size() + kBatchSize - 1) / kBatchSize;
+
+	// Pairs that meet the threshold, by batch
+	vector<vector<DocumentPair>> found(batch_cnt);
+
+	// The pool is shared with other requests, so this one keeps track of its
+	// own batches.
+	mutex done_mutex;
+	condition_variable done;
+	size_t remaining = batch_cnt;
+	exception_ptr error;
+
+	for (size_t batch = 0; batch < batch_cnt; ++batch) {
+		pool_.submit([&, batch](size_t worker) {
+			try {
+				Workspace &workspace = workspaces_[worker];
+
+				if (!workspace.scorer)
+					workspace.scorer.reset(new Scorer(index_, in_document_cnt_, threshold_));
+
+				for (size_t i = batch * kBatchSize; i < min(documents.size(), (batch + 1) * kBatchSize); ++i) {
+					workspace.document.id = i + 1;
+					workspace.reader.read(documents[i], workspace.document);
+					calculate_tfidf(workspace.document, workspace.document_ref, df_);
+
+					workspace.scorer->score(workspace.document_ref, [&](size_t in_idx, float score) {
+						if (score >= threshold_)
+							found[batch].push_back(DocumentPair{score, in_idx, i + 1});
+					});
+				}
+			} catch (...) {
+				lock_guard<mutex> lock(done_mutex);
+				if (!error)
+					error = current_exception();
+			}
+
+			lock_guard<mutex> lock(done_mutex);
+			if (--remaining == 0)
+				done.notify_all();
+		});
+	}
+
+	{
+		unique_lock<mutex> lock(done_mutex);
+		done.wait(lock, [&remaining]() { return remaining == 0; });
+	}
+
+	if (error)
+		rethrow_exception(error);
+
+	vector<DocumentPair> pairs;
+	for (vector<DocumentPair> const &batch_pairs : found)
+		pairs.insert(pairs.end(), batch_pairs.begin(), batch_pairs.end());
+
+	sort(pairs.begin(), pairs.end(), &better_pair);
+
+	// Same greedy pick as docalign, among the documents of this request
+	if (!print_all_) {
+		PairSelector selector(in_document_cnt_, documents.size());
+		vector<DocumentPair> best_pairs;
+
+		for (DocumentPair const &pair : pairs) {
+			if (selector.done())
+				break;
+
+			if (selector.add(pair))
+				best_pairs.push_back(pair);
+		}
+
+		pairs.swap(best_pairs);
+	}
+
+	++request_cnt_;
+	document_cnt_ += documents.size();
+	pair_cnt_ += pairs.size();
+	return pairs;
+}
+
+bool AlignServer::serve(int in, int out) {
+	LineConnection connection(in, out);
+	vector<string> documents;
+	string error;
+
+	while (read_request(connection, documents, error)) {
+		vector<DocumentPair> pairs;
+
+		try {
+			pairs = align(documents);
+		} catch (exception const &e) {
+			write_error(connection, e.what());
+			return false;
+		}
+
+		// The client went away
+		if (!write_response(connection, pairs))
+			return false;
+	}
+
+	if (!error.empty()) {
+		write_error(connection, error);
+		return false;
+	}
+
+	return true;
+}
+
+void AlignServer::listen(string const &path) {
+	util::scoped_fd socket(listen_unix(path));
+
+	struct sigaction action, old_int, old_term;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = &stop_on_signal;
+	sigemptyset(&action.sa_mask);
+
+	signal_pipe = stop_pipe_[1];
+	sigaction(SIGINT, &action, &old_int);
+	sigaction(SIGTERM, &action, &old_term);
+
+	list<unique_ptr<Connection>> connections;
+	int poll_error = 0;
+
+	while (true) {
+		pollfd fds[2] = {
+			{socket.get(), POLLIN, 0},
+			{stop_pipe_[0], POLLIN, 0}
+		};
+
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+
+			// Thrown once the connections are closed
+			poll_error = errno;
+			break;
+		}
+
+		if (fds[1].revents)
+			break;
+
+		for (auto it = connections.begin(); it != connections.end();) {
+			if ((*it)->done) {
+				(*it)->worker.join();
+				it = connections.erase(it);
+			} else {
+				++it;
+			}
+		}
+
+		if (!(fds[0].revents & POLLIN))
+			continue;
+
+		int fd = accept(socket.get(), nullptr, nullptr);
+		if (fd == -1)
+			continue;
+
+		connections.emplace_back(new Connection(fd));
+		Connection &connection = *connections.back();
+
+		connection.worker = thread([this, &connection]() {
+			serve(connection.fd.get(), connection.fd.get());
+			connection.done = true;
+		});
+	}
+
+	// Requests that are being scored still get their response, but nothing
+	// is read after that.
+	for (auto const &connection : connections)
+		shutdown(connection->fd.get(), SHUT_RD);
+
+	for (auto const &connection : connections)
+		connection->worker.join();
+
+	sigaction(SIGINT, &old_int, nullptr);
+	sigaction(SIGTERM, &old_term, nullptr);
+	signal_pipe = -1;
+
+	// Ready for another listen()
+	pollfd stopped{stop_pipe_[0], POLLIN, 0};
+	char drained[16];
+	while (poll(&stopped, 1, 0) > 0 && read(stop_pipe_[0], drained, sizeof(drained)) > 0)
+		continue;
+
+	unlink(path.c_str());
+
+	errno = poll_error;
+	UTIL_THROW_IF(poll_error, util::ErrnoException, "Could not wait for connections on " << path);
+}
+
+void AlignServer::stop() {
+	ssize_t written = write(stop_pipe_[1], "s", 1);
+	(void) written;
+}
+
+} // namespace bitextor
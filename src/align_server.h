@@ -0,0 +1,97 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "df_table.h"
+#include "document.h"
+#include "document_pair.h"
+#include "ngram_index.h"
+#include "scorer.h"
+#include "thread_pool.h"
+
+namespace bitextor {
+
+/**
+ * Aligns batches of English documents against an index of translated
+ * documents that stays in memory, for `docalign --serve`. Requests come in
+ * as described in serve_protocol.h, over stdin and stdout or a Unix socket
+ * with a thread per connection. The documents of a request are split into
+ * small batches that are read and scored on the shared pool of workers, so
+ * the batches of concurrent requests run side by side.
+ *
+ * Scores use the DF and index as they are, so they are the same as those of
+ * `docalign --load-index`. Each request gets its own best pairs, picked from
+ * all of its pairs that meet the threshold.
+ */
+class AlignServer {
+public:
+	// Documents scored by a worker at a time
+	static constexpr size_t kBatchSize = 64;
+
+	AlignServer(DFTable const &df, NGramIndex const &index, size_t in_document_cnt, size_t ngram_size, float threshold, bool print_all, ThreadPool &pool);
+
+	~AlignServer();
+
+	AlignServer(AlignServer const &other) = delete;
+	AlignServer &operator=(AlignServer const &other) = delete;
+
+	/**
+	 * Scores the base64 encoded documents against the index. Returns the best
+	 * pairs from best to worst, or with print_all all pairs that meet the
+	 * threshold. English documents are numbered from 1 in the order given.
+	 * Safe to call from several threads at once.
+	 */
+	std::vector<DocumentPair> align(std::vector<std::string> const &documents);
+
+	// Answers requests from in on out, until in ends or a request is malformed.
+	// Returns whether all requests were fine.
+	bool serve(int in, int out);
+
+	// Answers the requests of each connection to a Unix socket at path on a
+	// thread of its own, until stop() is called or the process gets SIGINT or
+	// SIGTERM. Removes the socket afterwards.
+	void listen(std::string const &path);
+
+	// Makes listen() return. Safe to call from any thread.
+	void stop();
+
+	inline size_t request_cnt() const { return request_cnt_.load(); }
+	inline size_t document_cnt() const { return document_cnt_.load(); }
+	inline size_t pair_cnt() const { return pair_cnt_.load(); }
+
+private:
+	struct Workspace {
+		explicit Workspace(size_t ngram_size)
+		: reader(ngram_size),
+		  document{0, {}},
+		  document_ref{0, {}} {
+			//
+		}
+
+		DocumentReader reader;
+		Document document;
+		DocumentRef document_ref;
+		std::unique_ptr<Scorer> scorer;
+	};
+
+	DFTable const &df_;
+	NGramIndex const &index_;
+	size_t in_document_cnt_;
+	float threshold_;
+	bool print_all_;
+	ThreadPool &pool_;
+
+	// One per worker of the pool
+	std::vector<Workspace> workspaces_;
+
+	std::atomic<size_t> request_cnt_;
+	std::atomic<size_t> document_cnt_;
+	std::atomic<size_t> pair_cnt_;
+
+	// Pipe that wakes up listen() to stop it
+	int stop_pipe_[2];
+};
+
+} // namespace bitextor
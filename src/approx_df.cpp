@@ -0,0 +1,57 @@
+#include "approx_df.h"
+#include <algorithm>
+#include <cmath>
+#include "util/exception.hh"
+
+using namespace std;
+
+namespace bitextor {
+
+CountMinSketch::CountMinSketch(size_t width)
+: shift_(64),
+  total_(0) {
+	// A shift of 64 would be undefined, so rows have at least two slots
+	size_t size = 2;
+	--shift_;
+
+	while (size * 2 <= width) {
+		size <<= 1;
+		--shift_;
+	}
+
+	counters_.resize(kCountMinDepth * (size_t(1) << (64 - shift_)), 0);
+}
+
+void CountMinSketch::merge(CountMinSketch const &other) {
+	UTIL_THROW_IF(other.counters_.size() != counters_.size(), util::Exception, "Cannot merge count-min sketches of different widths");
+
+	for (size_t i = 0; i < counters_.size(); ++i)
+		counters_[i] += other.counters_[i];
+
+	total_ += other.total_;
+}
+
+double CountMinSketch::confidence() const {
+	return 1.0 - exp(-double(kCountMinDepth));
+}
+
+void CountMinSketch::clear() {
+	fill(counters_.begin(), counters_.end(), 0);
+	total_ = 0;
+}
+
+HeavyHitters::HeavyHitters(size_t capacity)
+: capacity_(max(capacity, size_t(1))) {
+	counts_.reserve(capacity_);
+}
+
+void HeavyHitters::decrement() {
+	for (auto it = counts_.begin(); it != counts_.end();) {
+		if (--it->second == 0)
+			it = counts_.erase(it);
+		else
+			++it;
+	}
+}
+
+} // namespace bitextor
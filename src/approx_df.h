@@ -0,0 +1,135 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "ngram.h"
+
+namespace bitextor {
+
+// Rows of a count-min sketch, each with its own hash function
+constexpr size_t kCountMinDepth = 4;
+
+// Slot of hash in row `row` of a count-min sketch of 1 << (64 - shift) slots
+// per row. Each row multiplies the hash by a different odd constant and takes
+// the top bits, which only takes a single multiplication.
+inline size_t count_min_slot(uint64_t hash, size_t row, unsigned shift) {
+	static constexpr uint64_t kMultipliers[kCountMinDepth] = {
+		0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0xD6E8FEB86659FD93ull
+	};
+	return (row << (64 - shift)) + ((hash * kMultipliers[row]) >> shift);
+}
+
+/**
+ * Count of an ngram estimated from `sketch_cnt` count-min sketches, one for
+ * each file, that follow each other in `counters`. Follows how exact DF is
+ * counted: the count is that of the first file in which it is at least
+ * `min_count`, or 0 if there is none. Counts are multiplied by `scale` first.
+ */
+inline uint64_t count_min_df(uint32_t const *counters, size_t sketch_cnt, unsigned shift, uint64_t hash, uint64_t scale, uint64_t min_count) {
+	size_t sketch_size = kCountMinDepth << (64 - shift);
+
+	for (size_t i = 0; i < sketch_cnt; ++i) {
+		uint64_t count = UINT32_MAX;
+		for (size_t row = 0; row < kCountMinDepth; ++row)
+			count = std::min(count, uint64_t(counters[i * sketch_size + count_min_slot(hash, row, shift)]));
+
+		if (count * scale >= min_count && count > 0)
+			return count * scale;
+	}
+
+	return 0;
+}
+
+/**
+ * Count-min sketch of the number of documents each ngram occurs in. Estimates
+ * are never too low, and with probability 1 - e^-depth at most e / width times
+ * the total of all counts too high. Uses conservative updates: only the rows
+ * that hold the lowest count for an ngram are raised, which keeps the other
+ * rows, and with that the estimates, lower.
+ */
+class CountMinSketch {
+public:
+	// `width` slots per row, rounded down to a power of two
+	explicit CountMinSketch(size_t width);
+
+	inline void add(NGram const &ngram) {
+		size_t slots[kCountMinDepth];
+		uint32_t lowest = UINT32_MAX;
+
+		for (size_t row = 0; row < kCountMinDepth; ++row) {
+			slots[row] = count_min_slot(ngram.hash, row, shift_);
+			lowest = std::min(lowest, counters_[slots[row]]);
+		}
+
+		for (size_t row = 0; row < kCountMinDepth; ++row)
+			if (counters_[slots[row]] == lowest)
+				++counters_[slots[row]];
+
+		++total_;
+	}
+
+	// Adds the counts of a sketch of the same width. Estimates stay an upper
+	// bound, since they are for each sketch on its own.
+	void merge(CountMinSketch const &other);
+
+	inline size_t width() const { return counters_.size() / kCountMinDepth; }
+	inline unsigned shift() const { return shift_; }
+
+	// Number of times add() was called, over all merged sketches
+	inline size_t total() const { return total_; }
+
+	// Most an estimate is off with the probability below
+	inline double error_bound() const { return 2.718281828459045 / width() * total_; }
+
+	// Chance that an estimate is within error_bound() of the actual count
+	double confidence() const;
+
+	// Counters, row after row
+	inline std::vector<uint32_t> const &counters() const { return counters_; }
+
+	// Sets all counts back to zero
+	void clear();
+
+private:
+	std::vector<uint32_t> counters_;
+	unsigned shift_;
+	size_t total_;
+};
+
+/**
+ * Keeps track of the ngrams that occur most often, using the Misra-Gries
+ * algorithm: every ngram that makes up more than 1 / (capacity + 1) of all
+ * adds is guaranteed to be among them. Their counts are not exact, they are
+ * only used to pick ngrams.
+ */
+class HeavyHitters {
+public:
+	explicit HeavyHitters(size_t capacity);
+
+	inline void add(NGram const &ngram) {
+		auto it = counts_.find(ngram.hash);
+		if (it != counts_.end())
+			++it->second;
+		else if (counts_.size() < capacity_)
+			counts_.emplace(ngram.hash, 1);
+		else
+			decrement();
+	}
+
+	// Calls fun(ngram) for each of them
+	template <typename F> void each(F fun) const {
+		for (auto const &entry : counts_)
+			fun(NGram{entry.first});
+	}
+
+private:
+	size_t capacity_;
+	std::unordered_map<uint64_t, uint32_t> counts_;
+
+	// Lowers all counts by one, dropping those that reach zero
+	void decrement();
+};
+
+} // namespace bitextor
@@ -4,6 +4,26 @@
 
 namespace bitextor {
 
+// Size of the buffer base64_encode needs to encode `size` bytes.
+inline size_t base64_encoded_size(size_t size) {
+	return 4 * ((size + 2) / 3);
+}
+
+// Size of the buffer base64_decode needs to decode `size` bytes of base64.
+// This is a bit more than the decoded data itself, as the vectorised decoders
+// write past the end of their output.
+inline size_t base64_decoded_size(size_t size) {
+	return size / 4 * 3 + 3 + 8;
+}
+
+// Encode into a buffer of at least base64_encoded_size(in.size()) bytes.
+// Returns the number of bytes written.
+size_t base64_encode(const util::StringPiece &in, char *out);
+
+// Decode into a buffer of at least base64_decoded_size(in.size()) bytes.
+// Returns the number of decoded bytes.
+size_t base64_decode(const util::StringPiece &in, char *out);
+
 void base64_encode(const util::StringPiece &in, std::string &out);
 
 void base64_decode(const util::StringPiece &in, std::string &out);
@@ -0,0 +1,34 @@
+#include "bgzf.h"
+#include "util/exception.hh"
+
+namespace bitextor {
+
+bool is_bgzf_header(const char *header, size_t size) {
+	return size >= kBgzfHeaderSize
+		&& header[0] == '\x1f' && header[1] == '\x8b' && header[2] == '\x08'
+		&& (header[3] & 0x04) // FEXTRA
+		&& read_le(header + 10, 2) == 6
+		&& header[12] == 'B' && header[13] == 'C'
+		&& read_le(header + 14, 2) == 2;
+}
+
+void inflate_bgzf_block(z_stream &stream, const char *block, size_t block_size, char *out, std::string const &path) {
+	UTIL_THROW_IF(block_size < kBgzfHeaderSize + 8, util::Exception, "Corrupt BGZF block in " << path);
+
+	uint32_t crc = read_le(block + block_size - 8, 4);
+	uint32_t size = bgzf_inflated_size(block, block_size);
+
+	inflateReset(&stream);
+	stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(block + kBgzfHeaderSize));
+	stream.avail_in = block_size - kBgzfHeaderSize - 8;
+	stream.next_out = reinterpret_cast<Bytef *>(out);
+	stream.avail_out = size;
+
+	int status = inflate(&stream, Z_FINISH);
+	bool ok = status == Z_STREAM_END && stream.avail_out == 0
+		&& crc32(0, reinterpret_cast<Bytef const *>(out), size) == crc;
+
+	UTIL_THROW_IF(!ok, util::Exception, "Corrupt BGZF block in " << path);
+}
+
+} // namespace bitextor
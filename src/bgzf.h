@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <zlib.h>
+
+namespace bitextor {
+
+// Every BGZF block starts with a gzip header with a single extra field "BC"
+// that holds the size of the block.
+constexpr size_t kBgzfHeaderSize = 18;
+
+inline uint32_t read_le(const char *data, size_t bytes) {
+	uint32_t value = 0;
+	for (size_t i = 0; i < bytes; ++i)
+		value |= uint32_t(static_cast<unsigned char>(data[i])) << (8 * i);
+	return value;
+}
+
+bool is_bgzf_header(const char *header, size_t size);
+
+// Size of the whole block, header included, that starts with `header`
+inline size_t bgzf_block_size(const char *header) {
+	return read_le(header + 16, 2) + 1;
+}
+
+// Size of a whole block once decompressed
+inline size_t bgzf_inflated_size(const char *block, size_t block_size) {
+	return read_le(block + block_size - 4, 4);
+}
+
+/**
+ * Decompresses a whole block into `out`, which needs room for its inflated
+ * size, and checks it against its CRC. The stream needs to be set up with
+ * inflateInit2(&stream, -15). Throws if the block is corrupt.
+ */
+void inflate_bgzf_block(z_stream &stream, const char *block, size_t block_size, char *out, std::string const &path);
+
+} // namespace bitextor
@@ -1,4 +1,6 @@
 #pragma once
+#include <chrono>
+#include <cstdint>
 #include <queue>
 #include <mutex>
 #include <condition_variable>
@@ -6,11 +8,22 @@
 
 namespace bitextor {
 
+/**
+ * How often producers found the queue full (overflow) and consumers found it
+ * empty (underflow), and how long they waited for it in total.
+ */
 struct queue_performance {
 	size_t overflow;
 	size_t underflow;
+	uint64_t overflow_ns;
+	uint64_t underflow_ns;
 };
 
+// Nanoseconds since start
+inline uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
 template <typename T> class blocking_queue
 {
 public:
@@ -32,16 +45,20 @@ private:
 template <typename T> blocking_queue<T>::blocking_queue(size_t size)
 :
 	_size(size),
-	_performance{0,0} {
+	_performance{0, 0, 0, 0} {
 	//
 }
 
 template <typename T> void blocking_queue<T>::push(T &&item) {
 	std::unique_lock<std::mutex> mlock(_mutex);
 
-	while (_buffer.size() >= _size) {
-		++_performance.overflow;
-		_removed.wait(mlock);
+	if (_buffer.size() >= _size) {
+		auto start = std::chrono::steady_clock::now();
+		while (_buffer.size() >= _size) {
+			++_performance.overflow;
+			_removed.wait(mlock);
+		}
+		_performance.overflow_ns += elapsed_ns(start);
 	}
 
 	_buffer.push(std::move(item));
@@ -52,9 +69,13 @@ template <typename T> void blocking_queue<T>::push(T &&item) {
 template <typename T> void blocking_queue<T>::push(T const &item) {
 	std::unique_lock<std::mutex> mlock(_mutex);
 	
-	while (_buffer.size() >= _size) {
-		++_performance.overflow;
-		_removed.wait(mlock);
+	if (_buffer.size() >= _size) {
+		auto start = std::chrono::steady_clock::now();
+		while (_buffer.size() >= _size) {
+			++_performance.overflow;
+			_removed.wait(mlock);
+		}
+		_performance.overflow_ns += elapsed_ns(start);
 	}
 	
 	_buffer.push(item);
@@ -65,9 +86,13 @@ template <typename T> void blocking_queue<T>::push(T const &item) {
 template <typename T> T blocking_queue<T>::pop() {
 	std::unique_lock<std::mutex> mlock(_mutex);
 	
-	while (_buffer.empty()) {
-		++_performance.underflow;
-		_added.wait(mlock);
+	if (_buffer.empty()) {
+		auto start = std::chrono::steady_clock::now();
+		while (_buffer.empty()) {
+			++_performance.underflow;
+			_added.wait(mlock);
+		}
+		_performance.underflow_ns += elapsed_ns(start);
 	}
 	
 	T value = std::move(_buffer.front());
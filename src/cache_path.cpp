@@ -0,0 +1,24 @@
+#include "cache_path.h"
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include "util/murmur_hash.hh"
+
+using namespace std;
+
+namespace bitextor {
+
+string cache_path(string const &dir, string const &source, string const &extension) {
+	char resolved[PATH_MAX];
+	string full(realpath(source.c_str(), resolved) ? resolved : source.c_str());
+
+	size_t slash = source.rfind('/');
+	string name(slash == string::npos ? source : source.substr(slash + 1));
+
+	char hash[17];
+	snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(util::MurmurHash64A(full.data(), full.size())));
+
+	return dir + "/" + name + "." + hash + "." + extension;
+}
+
+} // namespace bitextor
@@ -0,0 +1,14 @@
+#pragma once
+#include <string>
+
+namespace bitextor {
+
+/**
+ * Where a file derived from `source` is kept in `dir`: DIR/NAME.HASH.EXTENSION,
+ * with the name of the source so they can be told apart, and a hash of its
+ * full path so sources with the same name in different directories don't
+ * share one.
+ */
+std::string cache_path(std::string const &dir, std::string const &source, std::string const &extension);
+
+} // namespace bitextor
@@ -0,0 +1,233 @@
+#include "chunk_reader.h"
+#include <cstring>
+#include <deque>
+#include <future>
+#include "bgzf.h"
+#include "util/exception.hh"
+#include "util/file.hh"
+#include "util/read_compressed.hh"
+
+using namespace std;
+
+namespace bitextor {
+
+namespace {
+
+// Bytes read at a time from a stream that can't be split up
+constexpr size_t kStreamChunkSize = 16 << 20;
+
+// BGZF blocks hold at most 64KB, so this many make up a chunk of at most 16MB.
+constexpr size_t kBgzfGroupSize = 256;
+
+// Chunks read ahead, on top of the ones being decompressed
+constexpr size_t kReadAhead = 4;
+
+// memrchr is a GNU extension
+inline const char *find_last(const char *begin, const char *end, char c) {
+	while (end != begin)
+		if (*--end == c)
+			return end;
+	return nullptr;
+}
+
+/**
+ * Decompresses a run of whole BGZF blocks into a single chunk.
+ */
+shared_ptr<Chunk> inflate_bgzf(vector<char> const &blocks, string const &path) {
+	size_t size = 0;
+	for (size_t pos = 0; pos < blocks.size(); pos += bgzf_block_size(&blocks[pos]))
+		size += bgzf_inflated_size(&blocks[pos], bgzf_block_size(&blocks[pos]));
+
+	shared_ptr<Chunk> chunk(make_shared<Chunk>());
+	chunk->data.resize(size);
+
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	UTIL_THROW_IF(inflateInit2(&stream, -15) != Z_OK, util::Exception, "Could not initialise zlib");
+
+	try {
+		size_t out = 0;
+		for (size_t pos = 0; pos < blocks.size();) {
+			const char *block = &blocks[pos];
+			size_t block_size = bgzf_block_size(block);
+			inflate_bgzf_block(stream, block, block_size, chunk->data.data() + out, path);
+			out += bgzf_inflated_size(block, block_size);
+			pos += block_size;
+		}
+	} catch (...) {
+		inflateEnd(&stream);
+		throw;
+	}
+
+	inflateEnd(&stream);
+	return chunk;
+}
+
+} // namespace
+
+ChunkReader::ChunkReader(std::string const &path, size_t threads)
+: path_(path),
+  threads_(max(threads, size_t(1))),
+  chunks_(kReadAhead),
+  stop_(false),
+  done_(false) {
+	thread_ = thread(&ChunkReader::run, this);
+}
+
+ChunkReader::~ChunkReader() {
+	stop_ = true;
+
+	// Unblock the reading thread, it pushes nullptr when it stops
+	while (!done_)
+		done_ = !chunks_.pop();
+
+	thread_.join();
+}
+
+shared_ptr<Chunk const> ChunkReader::next() {
+	if (done_)
+		return nullptr;
+
+	shared_ptr<Chunk const> chunk(chunks_.pop());
+
+	if (!chunk) {
+		done_ = true;
+		if (error_)
+			rethrow_exception(error_);
+	}
+
+	return chunk;
+}
+
+void ChunkReader::run() {
+	try {
+		util::scoped_fd fd(util::OpenReadOrThrow(path_.c_str()));
+
+		char header[kBgzfHeaderSize];
+		size_t header_size = util::ReadOrEOF(fd.get(), header, sizeof(header));
+
+		if (is_bgzf_header(header, header_size))
+			read_bgzf(fd.get(), header, header_size);
+		else
+			read_stream(fd.release(), header, header_size);
+
+		// Last line without a newline at the end
+		if (!carry_.empty()) {
+			shared_ptr<Chunk> chunk(make_shared<Chunk>());
+			chunk->data.swap(carry_);
+			chunk->lines = util::StringPiece(chunk->data.data(), chunk->data.size());
+			chunks_.push(std::move(chunk));
+		}
+	} catch (...) {
+		error_ = current_exception();
+	}
+
+	chunks_.push(nullptr);
+}
+
+void ChunkReader::read_stream(int fd, const char *header, size_t header_size) {
+	// Takes ownership of fd
+	util::ReadCompressed in(fd, header, header_size);
+
+	while (!stop_) {
+		shared_ptr<Chunk> chunk(make_shared<Chunk>());
+		chunk->data.resize(kStreamChunkSize);
+		chunk->data.resize(in.ReadOrEOF(chunk->data.data(), chunk->data.size()));
+
+		if (chunk->data.empty())
+			break;
+
+		split(std::move(chunk));
+	}
+}
+
+/**
+ * Reads groups of BGZF blocks, and decompresses up to `threads_` of them at
+ * the same time. Chunks are passed on in file order.
+ */
+void ChunkReader::read_bgzf(int fd, const char *header, size_t header_size) {
+	deque<future<shared_ptr<Chunk>>> pending;
+	bool eof = false;
+
+	while (!eof && !stop_) {
+		vector<char> blocks;
+
+		for (size_t i = 0; i < kBgzfGroupSize; ++i) {
+			size_t offset = blocks.size();
+			blocks.resize(offset + kBgzfHeaderSize);
+
+			if (header_size) {
+				copy(header, header + header_size, &blocks[offset]);
+				header_size = 0;
+			} else if (util::ReadOrEOF(fd, &blocks[offset], kBgzfHeaderSize) == 0) {
+				blocks.resize(offset);
+				eof = true;
+				break;
+			}
+
+			UTIL_THROW_IF(!is_bgzf_header(&blocks[offset], kBgzfHeaderSize), util::Exception,
+				"Expected another BGZF block in " << path_);
+
+			size_t block_size = bgzf_block_size(&blocks[offset]);
+			UTIL_THROW_IF(block_size < kBgzfHeaderSize + 8, util::Exception, "Corrupt BGZF block in " << path_);
+
+			blocks.resize(offset + block_size);
+			size_t rest = block_size - kBgzfHeaderSize;
+			UTIL_THROW_IF(util::ReadOrEOF(fd, &blocks[offset + kBgzfHeaderSize], rest) != rest, util::Exception,
+				"Truncated BGZF block in " << path_);
+		}
+
+		if (!blocks.empty())
+			pending.push_back(async(launch::async, [this](vector<char> const &blocks) {
+				return inflate_bgzf(blocks, path_);
+			}, std::move(blocks)));
+
+		while (pending.size() >= threads_ || (eof && !pending.empty())) {
+			split(pending.front().get());
+			pending.pop_front();
+		}
+	}
+}
+
+/**
+ * Passes on the complete lines of a chunk. The unfinished line at its end is
+ * kept aside and completed with the start of the next chunk, in a chunk of its
+ * own so the bulk of the data is never copied.
+ */
+void ChunkReader::split(shared_ptr<Chunk> &&chunk) {
+	if (chunk->data.empty())
+		return;
+
+	const char *begin = chunk->data.data();
+	const char *end = begin + chunk->data.size();
+
+	if (!carry_.empty()) {
+		const char *newline = static_cast<const char *>(memchr(begin, '\n', end - begin));
+
+		if (!newline) {
+			carry_.insert(carry_.end(), begin, end);
+			return;
+		}
+
+		shared_ptr<Chunk> joined(make_shared<Chunk>());
+		joined->data.swap(carry_);
+		joined->data.insert(joined->data.end(), begin, newline + 1);
+		joined->lines = util::StringPiece(joined->data.data(), joined->data.size());
+		chunks_.push(std::move(joined));
+
+		begin = newline + 1;
+	}
+
+	const char *last = find_last(begin, end, '\n');
+
+	if (!last) {
+		carry_.assign(begin, end);
+		return;
+	}
+
+	carry_.assign(last + 1, end);
+	chunk->lines = util::StringPiece(begin, last + 1 - begin);
+	chunks_.push(std::move(chunk));
+}
+
+} // namespace bitextor
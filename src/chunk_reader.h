@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "util/string_piece.hh"
+#include "blocking_queue.h"
+
+namespace bitextor {
+
+/**
+ * Block of decompressed input. Holds only complete lines, so lines never have
+ * to be stitched together from two chunks.
+ */
+struct Chunk {
+	std::vector<char> data;
+
+	// The lines in data, each including its newline. Only the very last line
+	// of a file might not have one.
+	util::StringPiece lines;
+};
+
+/**
+ * Reads a file in large chunks of complete lines, decompressing ahead on
+ * background threads. BGZF files (blocked gzip, as written by bgzip) are
+ * decompressed by several threads at once. Anything else goes through
+ * util::ReadCompressed on a single thread, which still overlaps with
+ * whatever the caller does with the chunks.
+ */
+class ChunkReader {
+public:
+	ChunkReader(std::string const &path, size_t threads);
+
+	// Stops reading ahead if the file was not read to the end
+	~ChunkReader();
+
+	// Next chunk of the file, or nullptr at the end of it. Rethrows whatever
+	// went wrong while reading.
+	std::shared_ptr<Chunk const> next();
+
+	// How often and how long the reading thread waited for chunks to be
+	// taken (overflow), and next() waited for a chunk (underflow)
+	inline queue_performance const &performance() const {
+		return chunks_.performance();
+	}
+
+private:
+	std::string path_;
+	size_t threads_;
+
+	// Chunks in file order, followed by nullptr once reading stopped
+	blocking_queue<std::shared_ptr<Chunk>> chunks_;
+	std::atomic<bool> stop_;
+	bool done_;
+	std::exception_ptr error_;
+	std::thread thread_;
+
+	// Part of the last line of the previous chunk
+	std::vector<char> carry_;
+
+	void run();
+	void read_stream(int fd, const char *header, size_t header_size);
+	void read_bgzf(int fd, const char *header, size_t header_size);
+	void split(std::shared_ptr<Chunk> &&chunk);
+};
+
+} // namespace bitextor
@@ -0,0 +1,100 @@
+#include "df_table.h"
+#include "index_file.h"
+#include <algorithm>
+#include <util/exception.hh>
+
+using namespace std;
+
+namespace bitextor {
+
+constexpr uint32_t DFTable::kMissing;
+
+constexpr uint32_t DFTable::kPruned;
+
+DFTable::DFTable()
+: slots_(vector<Slot>(1)),
+  mask_(0),
+  size_(0),
+  document_count_(0),
+  missing_idf_(0),
+  shift_(0),
+  scale_(1),
+  min_count_(0),
+  max_count_(0) {
+	//
+}
+
+DFTable::DFTable(unordered_map<NGram,size_t> const &df, unordered_set<NGram> const &max_ngram_pruned, size_t document_count)
+: size_(df.size() + max_ngram_pruned.size()),
+  document_count_(document_count),
+  missing_idf_(idf(1)),
+  shift_(0),
+  scale_(1),
+  min_count_(0),
+  max_count_(0) {
+	// Keep the load factor at or below 50%
+	size_t table_size = 1;
+	while (table_size < 2 * size_)
+		table_size <<= 1;
+
+	mask_ = table_size - 1;
+
+	// Value-initialised, so all slots start out empty
+	vector<Slot> slots(table_size);
+
+	for (auto const &entry : df)
+		insert(slots, entry.first, static_cast<uint32_t>(min(entry.second, size_t(kPruned - 1))));
+
+	for (auto const &ngram : max_ngram_pruned)
+		insert(slots, ngram, kPruned);
+
+	slots_ = FlatArray<Slot>(std::move(slots));
+}
+
+DFTable::DFTable(unordered_map<NGram,size_t> const &df, unordered_set<NGram> const &max_ngram_pruned, size_t document_count,
+	vector<uint32_t> &&sketches, unsigned shift, size_t scale, size_t min_count, size_t max_count)
+: DFTable(df, max_ngram_pruned, document_count) {
+	sketch_ = FlatArray<uint32_t>(std::move(sketches));
+	shift_ = shift;
+	scale_ = max(scale, size_t(1));
+	min_count_ = max(min_count, size_t(1));
+	max_count_ = max_count;
+}
+
+DFTable::DFTable(IndexReader &reader)
+: slots_(reader.read_array<Slot>()),
+  mask_(slots_.size() - 1),
+  size_(reader.read_value<uint64_t>()),
+  document_count_(reader.read_value<uint64_t>()),
+  missing_idf_(idf(1)),
+  sketch_(reader.read_array<uint32_t>()),
+  shift_(reader.read_value<uint64_t>()),
+  scale_(reader.read_value<uint64_t>()),
+  min_count_(reader.read_value<uint64_t>()),
+  max_count_(reader.read_value<uint64_t>()) {
+	UTIL_THROW_IF(slots_.empty() || (slots_.size() & mask_) != 0, util::Exception, "DF table in index file has an invalid size");
+	UTIL_THROW_IF(!sketch_.empty() && (shift_ < 1 || shift_ > 63 || sketch_.size() % (kCountMinDepth << (64 - shift_)) != 0),
+		util::Exception, "DF sketch in index file has an invalid size");
+}
+
+void DFTable::write(IndexWriter &writer) const {
+	writer.write_array(slots_);
+	writer.write_value<uint64_t>(size_);
+	writer.write_value<uint64_t>(document_count_);
+	writer.write_array(sketch_);
+	writer.write_value<uint64_t>(shift_);
+	writer.write_value<uint64_t>(scale_);
+	writer.write_value<uint64_t>(min_count_);
+	writer.write_value<uint64_t>(max_count_);
+}
+
+void DFTable::insert(vector<Slot> &slots, NGram const &ngram, uint32_t df) {
+	size_t slot = ngram.hash & mask_;
+	while (slots[slot].df != kMissing)
+		slot = (slot + 1) & mask_;
+	slots[slot].hash = ngram.hash;
+	slots[slot].df = df;
+	slots[slot].idf = df == kPruned ? 0 : idf(df);
+}
+
+} // namespace bitextor
@@ -0,0 +1,109 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include "approx_df.h"
+#include "flat_array.h"
+#include "ngram.h"
+
+namespace bitextor {
+
+class IndexReader;
+class IndexWriter;
+
+/**
+ * Read-only document frequency table, built once DF has been pruned. Ngrams
+ * that were pruned for occurring in too many documents are kept as well, but
+ * marked as such, so a single lookup tells how to treat any ngram. Stored as
+ * a flat open-addressing table so it can be written to and mapped from disk.
+ * Each ngram also gets its IDF computed up front, so a lookup is all it takes
+ * to weigh an ngram.
+ *
+ * With approximate DF the table only holds the most frequent ngrams, and the
+ * DF of all others comes from count-min sketches, pruned the same way.
+ */
+class DFTable {
+public:
+	struct Slot {
+		uint64_t hash;
+		uint32_t df;
+		float idf;
+	};
+
+	// What lookup() tells about an ngram
+	struct Entry {
+		uint32_t df;
+		float idf;
+	};
+
+	// Document frequency returned for ngrams that are not in the table
+	static constexpr uint32_t kMissing = 0;
+
+	// Document frequency returned for ngrams that occur in too many documents
+	static constexpr uint32_t kPruned = UINT32_MAX;
+
+	DFTable();
+
+	// IDF is relative to `document_count`, the number of documents in all
+	DFTable(std::unordered_map<NGram,size_t> const &df, std::unordered_set<NGram> const &max_ngram_pruned, size_t document_count);
+
+	// Approximate DF: ngrams not in `df` or `max_ngram_pruned` get the count
+	// of count_min_df() on `sketches`, pruned to [min_count, max_count].
+	DFTable(std::unordered_map<NGram,size_t> const &df, std::unordered_set<NGram> const &max_ngram_pruned, size_t document_count,
+		std::vector<uint32_t> &&sketches, unsigned shift, size_t scale, size_t min_count, size_t max_count);
+
+	explicit DFTable(IndexReader &reader);
+
+	void write(IndexWriter &writer) const;
+
+	// Document frequency of ngram, which is kMissing or kPruned for ngrams
+	// that are left out, and its IDF. Missing ngrams count as occurring in a
+	// single document.
+	inline Entry lookup(NGram const &ngram) const {
+		for (size_t slot = ngram.hash & mask_; slots_[slot].df != kMissing; slot = (slot + 1) & mask_)
+			if (slots_[slot].hash == ngram.hash)
+				return Entry{slots_[slot].df, slots_[slot].idf};
+
+		return sketch_.empty() ? Entry{kMissing, missing_idf_} : estimate(ngram);
+	}
+
+	// IDF of an ngram that occurs in `df` of all documents
+	inline float idf(size_t df) const {
+		return logf(document_count_ / (1.0f + df));
+	}
+
+	// Number of ngrams in the table, including the pruned ones
+	inline size_t size() const { return size_; }
+
+	// Whether DF is estimated for ngrams that are not in the table
+	inline bool approximate() const { return !sketch_.empty(); }
+
+private:
+	void insert(std::vector<Slot> &slots, NGram const &ngram, uint32_t df);
+
+	inline Entry estimate(NGram const &ngram) const {
+		uint64_t df = count_min_df(sketch_.data(), sketch_.size() / (kCountMinDepth << (64 - shift_)), shift_, ngram.hash, scale_, min_count_);
+
+		if (df == 0)
+			return Entry{kMissing, missing_idf_};
+		if (df > max_count_)
+			return Entry{kPruned, 0};
+		return Entry{uint32_t(df), idf(df)};
+	}
+
+	FlatArray<Slot> slots_;
+	size_t mask_;
+	size_t size_;
+	uint64_t document_count_;
+	float missing_idf_;
+
+	// Count-min sketches for approximate DF, or empty
+	FlatArray<uint32_t> sketch_;
+	unsigned shift_;
+	uint64_t scale_;
+	uint64_t min_count_;
+	uint64_t max_count_;
+};
+
+} // namespace bitextor
@@ -1,36 +1,72 @@
 #include "document.h"
 #include "base64.h"
 #include "ngram.h"
+#include "radix_sort.h"
 #include <cmath>
 
 using namespace std;
 
 namespace bitextor {
 
+DocumentReader::DocumentReader(size_t ngram_size)
+: ngram_size_(ngram_size) {
+	//
+}
+
 /**
- * Reads a single line of base64 encoded document into a Document.
+ * Reads a single line of base64 encoded document into a Document. Collects the
+ * hashes of all ngrams, sorts them, and counts runs of equal hashes.
  */
-void ReadDocument(const util::StringPiece &encoded, Document &document, size_t ngram_size)
+void DocumentReader::read(const util::StringPiece &encoded, Document &document)
 {
-	std::string body;
-	base64_decode(encoded, body);
+	base64_decode(encoded, body_);
+
+	hashes_.clear();
+	for (NGramIter ngram_it(body_, ngram_size_); ngram_it; ++ngram_it)
+		hashes_.push_back(ngram_it->hash);
+
+	radix_sort(hashes_, buffer_);
 
 	document.vocab.clear();
-	for (NGramIter ngram_it(body, ngram_size); ngram_it; ++ngram_it)
-		document.vocab[*ngram_it] += 1;
+	for (uint64_t hash : hashes_) {
+		if (!document.vocab.empty() && document.vocab.back().hash.hash == hash)
+			document.vocab.back().count += 1;
+		else
+			document.vocab.push_back(WordCount{.hash = NGram{hash}, .count = 1});
+	}
 }
 	
-inline float tfidf(size_t tf, size_t dc, size_t df) {
-	// Note: Matches tf_smooth setting 14 (2 for TF and 2 for IDF) of the python implementation
-	return logf(tf + 1) * logf(dc / (1.0f + df));
+namespace {
+
+// Term frequencies up to this have their log looked up
+constexpr size_t kLogTFTableSize = 256;
+
+struct LogTFTable {
+	float values[kLogTFTableSize];
+
+	LogTFTable() {
+		for (size_t tf = 0; tf < kLogTFTableSize; ++tf)
+			values[tf] = logf(tf + 1);
+	}
+};
+
+LogTFTable const log_tf_table;
+
+// Note: Matches tf_smooth setting 14 (2 for TF and 2 for IDF) of the python
+// implementation, together with DFTable::idf().
+inline float log_tf(size_t tf) {
+	return tf < kLogTFTableSize ? log_tf_table.values[tf] : logf(tf + 1);
 }
-	
+
+} // namespace
+
 /**
  * Calculate TF/DF based on how often an ngram occurs in this document and how often it occurs at least once
  * across all documents. Only terms that are seen in this document and in the document frequency table are
- * counted. All other terms are ignored.
+ * counted. All other terms are ignored. The vocab of document is sorted by hash,
+ * and so is the resulting wordvec.
 */
-void calculate_tfidf(Document const &document, DocumentRef &document_ref, size_t document_count, unordered_map<NGram, size_t> const &df, unordered_set<NGram> const &max_ngram_pruned) {
+void calculate_tfidf(Document const &document, DocumentRef &document_ref, DFTable const &df) {
 	document_ref.id = document.id;
 
 	document_ref.wordvec.clear();
@@ -39,24 +75,18 @@ void calculate_tfidf(Document const &document, DocumentRef &document_ref, size_t
 	float total_tfidf_l2 = 0;
 
 	for (auto const &entry : document.vocab) {
-		// How often does the term occur in the whole dataset?
-		auto it = df.find(entry.first);
-
-		float document_tfidf;
-
-		if (it == df.end()) {
-			if (max_ngram_pruned.find(entry.first) == max_ngram_pruned.end()) {
-				document_tfidf = tfidf(entry.second, document_count, 1);
-			}
-			else{
-				continue;
-			}
-		}
-		else {
-			document_tfidf = tfidf(entry.second, document_count, it->second);
+		// How often does the term occur in the whole dataset? Missing terms
+		// still count towards the norm, as if they occurred in one document.
+		DFTable::Entry found = df.lookup(entry.hash);
+
+		if (found.df == DFTable::kPruned)
+			continue;
+
+		float document_tfidf = log_tf(entry.count) * found.idf;
 
+		if (found.df != DFTable::kMissing) {
 			document_ref.wordvec.push_back(WordScore{
-					.hash = entry.first,
+					.hash = entry.hash,
 					.tfidf = document_tfidf
 			});
 		}
@@ -1,13 +1,17 @@
 #pragma once
 #include "util/string_piece.hh"
 #include "ngram.h"
-#include <istream>
-#include <unordered_map>
-#include <unordered_set>
+#include "df_table.h"
+#include <string>
 #include <vector>
 
 namespace bitextor {
 
+struct WordCount {
+	NGram hash;
+	size_t count;
+};
+
 struct WordScore {
 	NGram hash;
 	float tfidf;
@@ -16,22 +20,38 @@ struct WordScore {
 struct Document {
 	// Document offset, used as identifier
 	size_t id;
-	
-	// ngram frequency in document
-	std::unordered_map<NGram, size_t> vocab;
+
+	// ngram frequency in document, sorted by hash, each ngram once
+	std::vector<WordCount> vocab;
 };
 
 struct DocumentRef {
 	// Document offset, used as identifier
 	size_t id;
-	
+
 	// ngram scores as a sorted array for quick sparse dot product
 	std::vector<WordScore> wordvec;
 };
 
-// Assumes base64 encoded still.
-void ReadDocument(const util::StringPiece &encoded, Document &to, size_t ngram_size);
+/**
+ * Turns base64 encoded lines into documents. Holds the scratch space for
+ * decoding and sorting the ngrams, so use one per thread and reuse it, as well
+ * as the Document it reads into, to not allocate for every document.
+ */
+class DocumentReader {
+public:
+	explicit DocumentReader(size_t ngram_size);
+
+	// Assumes base64 encoded still. Does not touch document.id.
+	void read(const util::StringPiece &encoded, Document &document);
+
+private:
+	size_t ngram_size_;
+	std::string body_;
+	std::vector<uint64_t> hashes_;
+	std::vector<uint64_t> buffer_;
+};
 
-void calculate_tfidf(Document const &document, DocumentRef &document_ref, size_t document_count, std::unordered_map<NGram, size_t> const &df, std::unordered_set<NGram> const &max_ngram_pruned);
+void calculate_tfidf(Document const &document, DocumentRef &document_ref, DFTable const &df);
 
 } // namespace bitextor
@@ -0,0 +1,38 @@
+#include "document_pair.h"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+using namespace std;
+
+namespace bitextor {
+
+void print_score(float score, size_t left_id, size_t right_id)
+{
+	cout << fixed << setprecision(5)
+	     << score
+	     << '\t' << left_id
+	     << '\t' << right_id
+	     << '\n';
+}
+
+PairSelector::PairSelector(size_t in_document_cnt, size_t en_document_cnt)
+: in_seen_(in_document_cnt),
+  en_seen_(en_document_cnt),
+  picked_(0),
+  max_picked_(min(in_document_cnt, en_document_cnt)) {
+	//
+}
+
+bool PairSelector::add(DocumentPair const &pair) {
+	// If either of the documents has already been picked, skip it.
+	if (in_seen_[pair.in_idx - 1] || en_seen_[pair.en_idx - 1])
+		return false;
+
+	in_seen_[pair.in_idx - 1] = true;
+	en_seen_[pair.en_idx - 1] = true;
+	++picked_;
+	return true;
+}
+
+} // namespace bitextor
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+namespace bitextor {
+
+/**
+ * Score of a translated document (in) against an English document (en). Both
+ * indices start counting at 1.
+ */
+struct DocumentPair {
+	float score;
+	size_t in_idx;
+	size_t en_idx;
+};
+
+/**
+ * Order in which pairs are considered for the best matches: best score on top.
+ * Also sorts on the document indices to make it a consistent order, c.f. not
+ * depending on the processing order.
+ */
+inline bool better_pair(DocumentPair const &a, DocumentPair const &b)
+{
+	if (a.score != b.score)
+		return a.score > b.score;
+
+	if (a.in_idx != b.in_idx)
+		return a.in_idx > b.in_idx;
+
+	return a.en_idx > b.en_idx;
+}
+
+void print_score(float score, size_t left_id, size_t right_id);
+
+/**
+ * Greedy 1:1 assignment of documents. Fed pairs from best to worst, it picks
+ * every pair of which neither document was picked before.
+ */
+class PairSelector {
+public:
+	PairSelector(size_t in_document_cnt, size_t en_document_cnt);
+
+	// Returns whether pair was picked
+	bool add(DocumentPair const &pair);
+
+	// True once every document on the smaller side has been picked, after
+	// which no more pairs can be.
+	inline bool done() const { return picked_ == max_picked_; }
+
+	inline std::vector<bool> const &en_seen() const { return en_seen_; }
+
+private:
+	std::vector<bool> in_seen_;
+	std::vector<bool> en_seen_;
+	size_t picked_;
+	size_t max_picked_;
+};
+
+} // namespace bitextor
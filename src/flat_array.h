@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+namespace bitextor {
+
+/**
+ * Read-only array that either owns its elements, or points to elements that
+ * live elsewhere, e.g. in a memory mapped file. Whoever creates a non-owning
+ * array is responsible for keeping that memory alive.
+ */
+template <typename T> class FlatArray {
+public:
+	FlatArray()
+	: data_(nullptr),
+	  size_(0) {
+		//
+	}
+
+	explicit FlatArray(std::vector<T> &&owned)
+	: owned_(std::move(owned)),
+	  data_(owned_.data()),
+	  size_(owned_.size()) {
+		//
+	}
+
+	FlatArray(T const *data, size_t size)
+	: data_(data),
+	  size_(size) {
+		//
+	}
+
+	// Moving the vector keeps its buffer, so data_ stays valid. Copying would
+	// not, hence only moving is allowed.
+	FlatArray(FlatArray &&other) = default;
+	FlatArray &operator=(FlatArray &&other) = default;
+	FlatArray(FlatArray const &other) = delete;
+	FlatArray &operator=(FlatArray const &other) = delete;
+
+	inline T const &operator[](size_t index) const { return data_[index]; }
+	inline T const *data() const { return data_; }
+	inline T const *begin() const { return data_; }
+	inline T const *end() const { return data_ + size_; }
+	inline size_t size() const { return size_; }
+	inline bool empty() const { return size_ == 0; }
+
+private:
+	std::vector<T> owned_;
+	T const *data_;
+	size_t size_;
+};
+
+} // namespace bitextor
@@ -0,0 +1,231 @@
+#include "hashed_documents.h"
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cache_path.h"
+#include "util/exception.hh"
+
+using namespace std;
+
+namespace bitextor {
+
+namespace {
+
+inline size_t varint_size(uint64_t value) {
+	size_t size = 1;
+	for (; value >= 0x80; value >>= 7)
+		++size;
+	return size;
+}
+
+inline void append_varint(uint64_t value, string &out) {
+	for (; value >= 0x80; value >>= 7)
+		out.push_back(static_cast<char>(value | 0x80));
+	out.push_back(static_cast<char>(value));
+}
+
+inline const char *read_varint(const char *in, const char *end, uint64_t &value) {
+	value = 0;
+	for (unsigned shift = 0; in != end && shift < 64; shift += 7) {
+		uint8_t byte = static_cast<uint8_t>(*in++);
+		value |= uint64_t(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return in;
+	}
+
+	UTIL_THROW(util::Exception, "Corrupt hashed document");
+}
+
+void read_fully(int fd, void *data, size_t size, uint64_t offset, string const &path) {
+	for (size_t done = 0; done < size;) {
+		ssize_t read = pread(fd, static_cast<char *>(data) + done, size - done, offset + done);
+		UTIL_THROW_IF(read == -1, util::ErrnoException, "Could not read hashed documents of " << path);
+		UTIL_THROW_IF(read == 0, util::Exception, "Hashed documents of " << path << " are truncated");
+		done += read;
+	}
+}
+
+} // namespace
+
+void encode_document(Document const &document, string &out) {
+	size_t size = 0;
+	uint64_t last = 0;
+	for (WordCount const &entry : document.vocab) {
+		size += varint_size(entry.hash.hash - last) + varint_size(entry.count);
+		last = entry.hash.hash;
+	}
+
+	append_varint(size, out);
+
+	last = 0;
+	for (WordCount const &entry : document.vocab) {
+		append_varint(entry.hash.hash - last, out);
+		append_varint(entry.count, out);
+		last = entry.hash.hash;
+	}
+}
+
+void decode_document(util::StringPiece const &encoded, Document &document) {
+	const char *pos = encoded.data(), *end = pos + encoded.size();
+	uint64_t hash = 0, delta, count;
+
+	document.vocab.clear();
+	while (pos != end) {
+		pos = read_varint(pos, end, delta);
+		pos = read_varint(pos, end, count);
+		hash += delta;
+		document.vocab.push_back(WordCount{.hash = NGram{hash}, .count = count});
+	}
+}
+
+const char *read_document_size(const char *in, const char *end, size_t &size) {
+	uint64_t value;
+	in = read_varint(in, end, value);
+	UTIL_THROW_IF(value > uint64_t(end - in), util::Exception, "Corrupt hashed document");
+	size = value;
+	return in;
+}
+
+HashedDocumentFile::HashedDocumentFile(string const &source, size_t ngram_size, string const &dir, bool create)
+: source_(source),
+  header_(),
+  complete_(false),
+  file_(nullptr, &fclose),
+  size_(sizeof(header_)),
+  next_seq_(0),
+  written_cnt_(0) {
+	memcpy(header_.magic, kHashedDocumentsMagic, sizeof(kHashedDocumentsMagic));
+	header_.version = kHashedDocumentsVersion;
+	header_.ngram_size = ngram_size;
+
+	// Only a regular file can be recognised again in a later run
+	struct stat info;
+	if (stat(source.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+		return;
+
+	header_.source_size = info.st_size;
+	header_.source_mtime = uint64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+
+	path_ = cache_path(dir, source, "n" + to_string(ngram_size) + ".hdoc");
+	if (load(path_) || !create)
+		return;
+
+	// Written next to where it goes, and only moved there once complete
+	temp_path_ = path_ + ".tmp" + to_string(getpid());
+	file_.reset(fopen(temp_path_.c_str(), "w+b"));
+
+	// Room for the header, which is filled in once complete
+	if (!file_ || fwrite(&header_, sizeof(header_), 1, file_.get()) != 1)
+		file_.reset();
+}
+
+HashedDocumentFile::~HashedDocumentFile() {
+	if (!temp_path_.empty())
+		unlink(temp_path_.c_str());
+}
+
+bool HashedDocumentFile::load(string const &path) {
+	unique_ptr<FILE, int(*)(FILE*)> file(fopen(path.c_str(), "rb"), &fclose);
+	if (!file)
+		return false;
+
+	HashedDocumentsHeader header;
+	if (fread(&header, sizeof(header), 1, file.get()) != 1
+		|| memcmp(header.magic, kHashedDocumentsMagic, sizeof(kHashedDocumentsMagic)) != 0
+		|| header.version != kHashedDocumentsVersion
+		|| header.ngram_size != header_.ngram_size
+		|| header.source_size != header_.source_size
+		|| header.source_mtime != header_.source_mtime)
+		return false;
+
+	struct stat info;
+	if (fstat(fileno(file.get()), &info) == -1)
+		return false;
+
+	header_ = header;
+	size_ = info.st_size;
+	file_ = std::move(file);
+	complete_ = true;
+	return true;
+}
+
+void HashedDocumentFile::add(size_t seq, size_t document_cnt, string &&block) {
+	lock_guard<mutex> lock(mutex_);
+
+	// Once a write failed, the file is given up on, and the documents are
+	// read from the source again.
+	if (!writable())
+		return;
+
+	if (seq != next_seq_) {
+		pending_.emplace(seq, make_pair(document_cnt, std::move(block)));
+		return;
+	}
+
+	write(document_cnt, block);
+
+	for (auto it = pending_.begin(); file_ && it != pending_.end() && it->first == next_seq_; it = pending_.erase(it))
+		write(it->second.first, it->second.second);
+
+	if (!file_)
+		pending_.clear();
+}
+
+void HashedDocumentFile::write(size_t document_cnt, string const &block) {
+	uint32_t sizes[2] = {static_cast<uint32_t>(block.size()), static_cast<uint32_t>(document_cnt)};
+
+	if (block.size() > UINT32_MAX
+		|| fwrite(sizes, sizeof(sizes), 1, file_.get()) != 1
+		|| fwrite(block.data(), 1, block.size(), file_.get()) != block.size()) {
+		file_.reset();
+		return;
+	}
+
+	size_ += sizeof(sizes) + block.size();
+	written_cnt_ += document_cnt;
+	++next_seq_;
+}
+
+void HashedDocumentFile::finish(size_t document_cnt) {
+	lock_guard<mutex> lock(mutex_);
+
+	if (!writable())
+		return;
+
+	header_.document_cnt = document_cnt;
+
+	if (!pending_.empty() || written_cnt_ != document_cnt
+		|| fseek(file_.get(), 0, SEEK_SET) != 0
+		|| fwrite(&header_, sizeof(header_), 1, file_.get()) != 1
+		|| fflush(file_.get()) != 0) {
+		file_.reset();
+		return;
+	}
+
+	// If it can't be moved into place it is still good for this run
+	if (!temp_path_.empty() && rename(temp_path_.c_str(), path_.c_str()) == 0)
+		temp_path_.clear();
+
+	complete_ = true;
+}
+
+size_t HashedDocumentFile::read(uint64_t &offset, vector<char> &block) const {
+	UTIL_THROW_IF(!complete_, util::Exception, "Hashed documents of " << source_ << " are incomplete");
+
+	if (offset < sizeof(header_))
+		offset = sizeof(header_);
+
+	if (offset >= size_)
+		return 0;
+
+	uint32_t sizes[2];
+	read_fully(fileno(file_.get()), sizes, sizeof(sizes), offset, source_);
+
+	block.resize(sizes[0]);
+	read_fully(fileno(file_.get()), block.data(), block.size(), offset + sizeof(sizes), source_);
+
+	offset += sizeof(sizes) + block.size();
+	return sizes[1];
+}
+
+} // namespace bitextor
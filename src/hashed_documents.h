@@ -0,0 +1,128 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "util/string_piece.hh"
+#include "document.h"
+
+namespace bitextor {
+
+/**
+ * Appends document as DocumentReader made it: the size of the rest in bytes,
+ * followed by the difference of each ngram hash to the one before it and how
+ * often the ngram occurs, all as varints. The hashes are sorted, so the
+ * differences are positive, and the size allows skipping a document without
+ * decoding it.
+ */
+void encode_document(Document const &document, std::string &out);
+
+// Reads the document that `encoded` points at, without its size in front,
+// into document. Does not touch document.id.
+void decode_document(util::StringPiece const &encoded, Document &document);
+
+// Reads the size of the encoded document at `in`, and returns where the
+// document starts.
+const char *read_document_size(const char *in, const char *end, size_t &size);
+
+/**
+ * Start of a file of hashed documents, followed by blocks of consecutive
+ * documents: the size of the block in bytes and the number of documents in
+ * it as two uint32_t, and then the documents as encode_document writes them.
+ */
+struct HashedDocumentsHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t ngram_size;
+
+	// Size and modification time in nanoseconds of the file the documents
+	// were read from
+	uint64_t source_size;
+	uint64_t source_mtime;
+
+	uint64_t document_cnt;
+};
+
+// Increase whenever the layout of the file changes
+constexpr uint32_t kHashedDocumentsVersion = 1;
+
+constexpr char kHashedDocumentsMagic[8] = {'H', 'A', 'S', 'H', 'D', 'O', 'C', 'S'};
+
+/**
+ * The documents of an input file, hashed into ngrams for a single ngram size.
+ * Reading those is a lot cheaper than base64 decoding and hashing the lines
+ * again, so docalign writes them during its first pass over a file and reads
+ * them instead of the file in later passes.
+ *
+ * They are kept as DIR/NAME.HASH.nN.hdoc, where HASH stands for the full path
+ * of the file. Later runs with the same ngram size read those instead of the
+ * file at all, for as long as the file keeps the same size and modification
+ * time. Only regular files get hashed documents.
+ *
+ * Unless kept from an earlier run, the documents are written to a temporary
+ * file next to where they go, if `create` is set. If that file can't be
+ * created, or writing it fails, it is given up on and neither complete()
+ * nor writable().
+ */
+class HashedDocumentFile {
+public:
+	HashedDocumentFile(std::string const &source, size_t ngram_size, std::string const &dir, bool create = true);
+
+	~HashedDocumentFile();
+
+	HashedDocumentFile(HashedDocumentFile const &other) = delete;
+	HashedDocumentFile &operator=(HashedDocumentFile const &other) = delete;
+
+	// Whether it holds all documents of the file, and can be read instead
+	inline bool complete() const { return complete_; }
+
+	// Whether documents can still be added: it is not complete, and writing
+	// it never failed.
+	inline bool writable() const { return !complete_ && bool(file_); }
+
+	inline size_t document_cnt() const { return header_.document_cnt; }
+
+	// Where it is kept
+	inline std::string const &path() const { return path_; }
+
+	/**
+	 * Adds block `seq` (counting from 0) of `document_cnt` encoded documents.
+	 * Blocks end up in the file in order, so one that comes ahead of its turn
+	 * is held on to until all blocks before it are added. Safe to call from
+	 * any thread.
+	 */
+	void add(size_t seq, size_t document_cnt, std::string &&block);
+
+	// Marks it complete once all `document_cnt` documents have been added,
+	// and moves it into place if it is kept.
+	void finish(size_t document_cnt);
+
+	// Reads the block at `offset` into `block`, and moves `offset` on to the
+	// next one. Returns the number of documents in the block, or 0 at the end.
+	// Only once complete.
+	size_t read(uint64_t &offset, std::vector<char> &block) const;
+
+private:
+	std::string source_;
+	std::string path_;
+	std::string temp_path_;
+	HashedDocumentsHeader header_;
+	bool complete_;
+
+	std::unique_ptr<std::FILE, int(*)(std::FILE*)> file_;
+	uint64_t size_;
+
+	// Blocks added ahead of the next one to write, by sequence number
+	std::mutex mutex_;
+	std::map<size_t, std::pair<size_t, std::string>> pending_;
+	size_t next_seq_;
+	size_t written_cnt_;
+
+	bool load(std::string const &path);
+	void write(size_t document_cnt, std::string const &block);
+};
+
+} // namespace bitextor
@@ -0,0 +1,53 @@
+#include "index_file.h"
+
+namespace bitextor {
+
+IndexWriter::IndexWriter(std::string const &path)
+: path_(path),
+  file_(std::fopen(path.c_str(), "wb"), &std::fclose),
+  offset_(0) {
+	UTIL_THROW_IF(!file_, util::ErrnoException, "Could not open " << path << " for writing");
+}
+
+void IndexWriter::write_header(IndexHeader header) {
+	std::memcpy(header.magic, kIndexMagic, sizeof(kIndexMagic));
+	header.version = kIndexVersion;
+	write_value(header);
+}
+
+void IndexWriter::write(void const *data, size_t size) {
+	UTIL_THROW_IF(std::fwrite(data, 1, size, file_.get()) != size, util::ErrnoException, "Could not write to " << path_);
+	offset_ += size;
+}
+
+void IndexWriter::pad() {
+	static char const zeros[8] = {0};
+	write(zeros, (8 - offset_ % 8) % 8);
+}
+
+void IndexWriter::close() {
+	UTIL_THROW_IF(std::fclose(file_.release()) != 0, util::ErrnoException, "Could not write to " << path_);
+}
+
+IndexReader::IndexReader(MappedFile const &file)
+: file_(file),
+  offset_(0) {
+	header_ = read_value<IndexHeader>();
+	UTIL_THROW_IF(std::memcmp(header_.magic, kIndexMagic, sizeof(kIndexMagic)) != 0, util::Exception,
+		file_.path() << " is not a docalign index file");
+	UTIL_THROW_IF(header_.version != kIndexVersion, util::Exception, file_.path() << " is an index file of version "
+		<< header_.version << " but this docalign reads version " << kIndexVersion);
+}
+
+char const *IndexReader::read(size_t size) {
+	UTIL_THROW_IF(size > file_.size() - offset_, util::Exception, "Unexpected end of " << file_.path());
+	char const *data = file_.data() + offset_;
+	offset_ += size;
+	return data;
+}
+
+void IndexReader::skip_padding() {
+	read((8 - offset_ % 8) % 8);
+}
+
+} // namespace bitextor
@@ -0,0 +1,102 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <util/exception.hh>
+#include "flat_array.h"
+#include "mapped_file.h"
+
+namespace bitextor {
+
+/**
+ * Start of a file written by `docalign --save-index`. It is followed by the
+ * DF table and the reference index, as written by their write() methods. All
+ * values are stored in native byte order, and every array starts at a
+ * multiple of 8 bytes so it can be used directly from a memory mapped file.
+ */
+struct IndexHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t ngram_size;
+	uint64_t in_document_cnt;
+	uint64_t en_document_cnt;
+	uint64_t document_cnt;
+};
+
+// Increase whenever the layout of the index file changes
+constexpr uint32_t kIndexVersion = 6;
+
+constexpr char kIndexMagic[8] = {'D', 'O', 'C', 'A', 'L', 'I', 'G', 'N'};
+
+class IndexWriter {
+public:
+	explicit IndexWriter(std::string const &path);
+
+	// Writes the header, filling in the magic and version.
+	void write_header(IndexHeader header);
+
+	template <typename T> void write_value(T const &value) {
+		write(&value, sizeof(T));
+	}
+
+	// Writes the number of elements followed by the elements themselves,
+	// padded to a multiple of 8 bytes.
+	template <typename T> void write_array(FlatArray<T> const &array) {
+		write_value<uint64_t>(array.size());
+		write_value<uint64_t>(sizeof(T));
+		write(array.data(), array.size() * sizeof(T));
+		pad();
+	}
+
+	// Flushes and closes the file, throwing if anything went wrong.
+	void close();
+
+private:
+	void write(void const *data, size_t size);
+	void pad();
+
+	std::string path_;
+	std::unique_ptr<std::FILE, int(*)(std::FILE*)> file_;
+	size_t offset_;
+};
+
+/**
+ * Reads values and arrays back from a memory mapped index file, in the same
+ * order as they were written. Arrays point directly into the mapping.
+ */
+class IndexReader {
+public:
+	explicit IndexReader(MappedFile const &file);
+
+	IndexHeader const &header() const { return header_; }
+
+	template <typename T> T read_value() {
+		T value;
+		std::memcpy(&value, read(sizeof(T)), sizeof(T));
+		return value;
+	}
+
+	template <typename T> FlatArray<T> read_array() {
+		uint64_t size = read_value<uint64_t>();
+		uint64_t element_size = read_value<uint64_t>();
+		UTIL_THROW_IF(element_size != sizeof(T), util::Exception, "Unexpected element size " << element_size
+			<< " instead of " << sizeof(T) << " in " << file_.path());
+		UTIL_THROW_IF(size > (file_.size() - offset_) / sizeof(T), util::Exception, "Array of " << size
+			<< " elements does not fit in " << file_.path());
+		T const *data = reinterpret_cast<T const *>(read(size * sizeof(T)));
+		skip_padding();
+		return FlatArray<T>(data, size);
+	}
+
+private:
+	char const *read(size_t size);
+	void skip_padding();
+
+	MappedFile const &file_;
+	size_t offset_;
+	IndexHeader header_;
+};
+
+} // namespace bitextor
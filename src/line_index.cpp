@@ -0,0 +1,314 @@
+#include "line_index.h"
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bgzf.h"
+#include "cache_path.h"
+#include "util/exception.hh"
+#include "util/read_compressed.hh"
+
+using namespace std;
+
+namespace bitextor {
+
+namespace {
+
+// Bytes read at a time while looking for newlines
+constexpr size_t kReadSize = 16 << 20;
+
+constexpr char kLineIndexMagic[8] = {'L', 'I', 'N', 'E', 'I', 'D', 'X', '\0'};
+
+// Increase whenever the layout of the cache file changes
+constexpr uint32_t kLineIndexVersion = 1;
+
+/**
+ * Start of a cached line index, followed by the offsets of all lines and the
+ * end of the last one, in native byte order.
+ */
+struct LineIndexHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t format;
+	uint64_t file_size;
+	uint64_t mtime;
+	uint64_t line_cnt;
+};
+
+// Whether the header is that of a compressed file util::ReadCompressed reads:
+// gzip, bzip2 or xz.
+bool is_compressed(const char *header, size_t size) {
+	return (size >= 2 && memcmp(header, "\x1f\x8b", 2) == 0)
+		|| (size >= 3 && memcmp(header, "BZh", 3) == 0)
+		|| (size >= 6 && memcmp(header, "\xfd" "7zXZ\0", 6) == 0);
+}
+
+bool is_zstd(const char *header, size_t size) {
+	return size >= 4 && memcmp(header, "\x28\xb5\x2f\xfd", 4) == 0;
+}
+
+// Adds the start of every line that begins after a newline in data, which
+// starts at offset `base` in the file.
+void add_lines(const char *data, size_t size, uint64_t base, vector<uint64_t> &offsets) {
+	for (const char *end = data + size, *it = data; (it = static_cast<const char *>(memchr(it, '\n', end - it))); ++it)
+		offsets.push_back(base + (it - data) + 1);
+}
+
+} // namespace
+
+LineIndex::LineIndex(string const &path, string const &cache_dir)
+: path_(path),
+  format_(kPlain),
+  file_(util::OpenReadOrThrow(path.c_str())),
+  copy_(nullptr, &fclose),
+  block_offset_(UINT64_MAX),
+  next_block_offset_(0) {
+	memset(&stream_, 0, sizeof(stream_));
+	UTIL_THROW_IF(inflateInit2(&stream_, -15) != Z_OK, util::Exception, "Could not initialise zlib");
+
+	try {
+		struct stat info;
+		UTIL_THROW_IF(fstat(file_.get(), &info) == -1, util::ErrnoException, "Could not stat " << path);
+
+		char header[kBgzfHeaderSize];
+		size_t header_size = 0;
+
+		// Pipes can only be read once, so they always end up copied
+		bool regular = S_ISREG(info.st_mode);
+		if (regular)
+			header_size = pread(file_.get(), header, sizeof(header), 0);
+		else
+			header_size = util::ReadOrEOF(file_.get(), header, sizeof(header));
+
+		UTIL_THROW_IF(header_size == size_t(-1), util::ErrnoException, "Could not read " << path);
+		UTIL_THROW_IF(is_zstd(header, header_size), util::Exception,
+			path << " is compressed with zstd, which is not supported. Recompress it with bgzip.");
+
+		uint64_t mtime = uint64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+		bool cache = !cache_dir.empty();
+		string cache_file(cache ? cache_path(cache_dir, path, "lidx") : "");
+		vector<uint64_t> offsets;
+
+		if (regular && is_bgzf_header(header, header_size)) {
+			format_ = kBgzf;
+			if (!cache || !load_cache(cache_file, info.st_size, mtime)) {
+				index_bgzf(offsets);
+				offsets_ = FlatArray<uint64_t>(std::move(offsets));
+				if (cache)
+					save_cache(cache_file, info.st_size, mtime);
+			}
+		} else if (regular && !is_compressed(header, header_size)) {
+			if (!cache || !load_cache(cache_file, info.st_size, mtime)) {
+				index_plain(file_.get(), offsets);
+				offsets_ = FlatArray<uint64_t>(std::move(offsets));
+				if (cache)
+					save_cache(cache_file, info.st_size, mtime);
+			}
+		} else {
+			if (regular)
+				UTIL_THROW_IF(lseek(file_.get(), header_size, SEEK_SET) == -1, util::ErrnoException, "Could not seek in " << path);
+			index_copy(file_.release(), header, header_size, offsets);
+			offsets_ = FlatArray<uint64_t>(std::move(offsets));
+		}
+	} catch (...) {
+		inflateEnd(&stream_);
+		throw;
+	}
+}
+
+LineIndex::~LineIndex() {
+	inflateEnd(&stream_);
+}
+
+void LineIndex::index_plain(int fd, vector<uint64_t> &offsets) {
+	vector<char> buffer(kReadSize);
+	uint64_t offset = 0;
+	char last = '\n';
+
+	offsets.push_back(0);
+
+	while (true) {
+		ssize_t size = pread(fd, buffer.data(), buffer.size(), offset);
+		UTIL_THROW_IF(size == -1, util::ErrnoException, "Could not read " << path_);
+		if (size == 0)
+			break;
+
+		add_lines(buffer.data(), size, offset, offsets);
+		offset += size;
+		last = buffer[size - 1];
+	}
+
+	// Last line without a newline at the end
+	if (last != '\n')
+		offsets.push_back(offset);
+}
+
+void LineIndex::index_copy(int fd, const char *header, size_t header_size, vector<uint64_t> &offsets) {
+	// Takes ownership of fd
+	util::ReadCompressed in(fd, header, header_size);
+
+	copy_.reset(tmpfile());
+	UTIL_THROW_IF(!copy_, util::Exception, "Could not create temporary file for decompressing " << path_);
+
+	vector<char> buffer(kReadSize);
+	uint64_t offset = 0;
+	char last = '\n';
+
+	offsets.push_back(0);
+
+	while (size_t size = in.ReadOrEOF(buffer.data(), buffer.size())) {
+		UTIL_THROW_IF(fwrite(buffer.data(), 1, size, copy_.get()) != size, util::ErrnoException,
+			"Could not write decompressed " << path_ << " to temporary file");
+		add_lines(buffer.data(), size, offset, offsets);
+		offset += size;
+		last = buffer[size - 1];
+	}
+
+	if (last != '\n')
+		offsets.push_back(offset);
+
+	UTIL_THROW_IF(fflush(copy_.get()) != 0, util::ErrnoException,
+		"Could not write decompressed " << path_ << " to temporary file");
+
+	// Lines are read from the copy from now on
+	file_.reset(dup(fileno(copy_.get())));
+	UTIL_THROW_IF(file_.get() == -1, util::ErrnoException, "Could not duplicate file descriptor");
+}
+
+void LineIndex::index_bgzf(vector<uint64_t> &offsets) {
+	bool unfinished = false;
+
+	offsets.push_back(0);
+
+	for (uint64_t offset = 0; read_block(offset); offset = next_block_offset_) {
+		if (block_.empty())
+			continue;
+
+		// A line that starts right after the end of a block starts at the
+		// beginning of the next one. That keeps the offset within a block
+		// below 1 << 16, even for a full block.
+		for (const char *it = block_.data(), *end = it + block_.size(); (it = static_cast<const char *>(memchr(it, '\n', end - it))); ++it) {
+			size_t next = it - block_.data() + 1;
+			offsets.push_back(next < block_.size() ? offset << 16 | next : next_block_offset_ << 16);
+		}
+
+		unfinished = block_.back() != '\n';
+	}
+
+	if (unfinished)
+		offsets.push_back(next_block_offset_ << 16);
+}
+
+bool LineIndex::read_block(uint64_t offset) {
+	if (offset == block_offset_)
+		return true;
+
+	compressed_.resize(kBgzfHeaderSize);
+	ssize_t size = pread(file_.get(), compressed_.data(), kBgzfHeaderSize, offset);
+	UTIL_THROW_IF(size == -1, util::ErrnoException, "Could not read " << path_);
+	if (size == 0)
+		return false;
+
+	UTIL_THROW_IF(!is_bgzf_header(compressed_.data(), size), util::Exception,
+		"Expected another BGZF block in " << path_);
+
+	size_t block_size = bgzf_block_size(compressed_.data());
+	UTIL_THROW_IF(block_size < kBgzfHeaderSize + 8, util::Exception, "Corrupt BGZF block in " << path_);
+
+	compressed_.resize(block_size);
+	size_t rest = block_size - kBgzfHeaderSize;
+	UTIL_THROW_IF(pread(file_.get(), &compressed_[kBgzfHeaderSize], rest, offset + kBgzfHeaderSize) != ssize_t(rest),
+		util::Exception, "Truncated BGZF block in " << path_);
+
+	// Forget the cached block first, in case this one turns out corrupt
+	block_offset_ = UINT64_MAX;
+	block_.resize(bgzf_inflated_size(compressed_.data(), block_size));
+	inflate_bgzf_block(stream_, compressed_.data(), block_size, block_.data(), path_);
+
+	block_offset_ = offset;
+	next_block_offset_ = offset + block_size;
+	return true;
+}
+
+void LineIndex::read(size_t n, string &line) {
+	UTIL_THROW_IF(n >= size(), util::Exception, "Line " << n << " is beyond the " << size() << " lines of " << path_);
+
+	uint64_t begin = offsets_[n], end = offsets_[n + 1];
+	line.clear();
+
+	if (format_ == kPlain) {
+		line.resize(end - begin);
+		size_t done = 0;
+		while (done < line.size()) {
+			ssize_t size = pread(file_.get(), &line[done], line.size() - done, begin + done);
+			UTIL_THROW_IF(size <= 0, util::ErrnoException, "Could not read line " << n << " of " << path_);
+			done += size;
+		}
+	} else {
+		// The line might run over into the following blocks
+		for (uint64_t pos = begin; pos < end; pos = next_block_offset_ << 16) {
+			UTIL_THROW_IF(!read_block(pos >> 16), util::Exception, "Unexpected end of " << path_);
+			size_t in_block = pos & 0xffff;
+			size_t until = (end >> 16) == (pos >> 16) ? (end & 0xffff) : block_.size();
+			UTIL_THROW_IF(in_block > until || until > block_.size(), util::Exception,
+				"Line index does not match " << path_);
+			line.append(block_.data() + in_block, until - in_block);
+		}
+	}
+
+	if (!line.empty() && line.back() == '\n')
+		line.pop_back();
+	if (!line.empty() && line.back() == '\r')
+		line.pop_back();
+}
+
+bool LineIndex::load_cache(string const &cache_path, uint64_t file_size, uint64_t mtime) {
+	if (access(cache_path.c_str(), R_OK) != 0)
+		return false;
+
+	unique_ptr<MappedFile> file(new MappedFile(cache_path));
+	LineIndexHeader header;
+
+	if (file->size() < sizeof(header))
+		return false;
+
+	memcpy(&header, file->data(), sizeof(header));
+
+	bool valid = memcmp(header.magic, kLineIndexMagic, sizeof(kLineIndexMagic)) == 0
+		&& header.version == kLineIndexVersion
+		&& header.format == format_
+		&& header.file_size == file_size
+		&& header.mtime == mtime
+		&& (file->size() - sizeof(header)) / sizeof(uint64_t) == header.line_cnt + 1;
+
+	if (!valid)
+		return false;
+
+	offsets_ = FlatArray<uint64_t>(reinterpret_cast<uint64_t const *>(file->data() + sizeof(header)), header.line_cnt + 1);
+	cache_ = std::move(file);
+	return true;
+}
+
+void LineIndex::save_cache(string const &cache_path, uint64_t file_size, uint64_t mtime) const {
+	// Written under another name first, so nobody ever reads half of it
+	string tmp_path(cache_path + ".tmp" + to_string(getpid()));
+	FILE *file = fopen(tmp_path.c_str(), "wb");
+	if (!file)
+		return;
+
+	LineIndexHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kLineIndexMagic, sizeof(kLineIndexMagic));
+	header.version = kLineIndexVersion;
+	header.format = format_;
+	header.file_size = file_size;
+	header.mtime = mtime;
+	header.line_cnt = size();
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(offsets_.data(), sizeof(uint64_t), offsets_.size(), file) == offsets_.size();
+
+	if (fclose(file) != 0 || !ok || rename(tmp_path.c_str(), cache_path.c_str()) != 0)
+		unlink(tmp_path.c_str());
+}
+
+} // namespace bitextor
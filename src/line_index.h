@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "util/file.hh"
+#include "flat_array.h"
+#include "mapped_file.h"
+
+namespace bitextor {
+
+/**
+ * Random access to the lines of a file through the offset at which each of
+ * them starts, so only the lines asked for are ever read. Plain files are
+ * read where they are. BGZF files (as written by bgzip) are read a block at a
+ * time, using virtual offsets: the offset of the block in the file shifted
+ * left 16 bits, plus the offset in its decompressed data. Anything else, like
+ * gzip or xz, or a pipe, is first decompressed to a temporary file.
+ *
+ * For plain and BGZF files, the offsets can be kept in a cache directory as
+ * NAME.HASH.lidx (see cache_path), and used instead of reading through the
+ * file again as long as the file keeps the same size and modification time.
+ * If that can't be written the offsets are just not kept.
+ */
+class LineIndex {
+public:
+	// Without a cache_dir, nothing is written besides the temporary copy of a
+	// compressed file.
+	explicit LineIndex(std::string const &path, std::string const &cache_dir = "");
+
+	~LineIndex();
+
+	LineIndex(LineIndex const &other) = delete;
+	LineIndex &operator=(LineIndex const &other) = delete;
+
+	// Number of lines. The last line counts even without a newline.
+	inline size_t size() const { return offsets_.size() - 1; }
+
+	// Line n, counting from 0, without its newline or carriage return
+	void read(size_t n, std::string &line);
+
+	inline std::string const &path() const { return path_; }
+
+	// Whether the offsets came from the cache directory
+	inline bool cached() const { return bool(cache_); }
+
+private:
+	enum Format : uint32_t {
+		kPlain = 0,
+		kBgzf = 1
+	};
+
+	std::string path_;
+	Format format_;
+	util::scoped_fd file_;
+
+	// Decompressed copy of the file, if it could not be read where it is
+	std::unique_ptr<std::FILE, int(*)(std::FILE*)> copy_;
+
+	// Start of every line, followed by the end of the last one
+	FlatArray<uint64_t> offsets_;
+	std::unique_ptr<MappedFile> cache_;
+
+	// Last BGZF block read, and where the block after it starts
+	z_stream stream_;
+	uint64_t block_offset_;
+	uint64_t next_block_offset_;
+	std::vector<char> block_;
+	std::vector<char> compressed_;
+
+	bool load_cache(std::string const &cache_path, uint64_t file_size, uint64_t mtime);
+	void save_cache(std::string const &cache_path, uint64_t file_size, uint64_t mtime) const;
+
+	void index_plain(int fd, std::vector<uint64_t> &offsets);
+	void index_bgzf(std::vector<uint64_t> &offsets);
+	void index_copy(int fd, const char *header, size_t header_size, std::vector<uint64_t> &offsets);
+
+	// Reads the BGZF block at offset into block_, unless it already is. Returns
+	// false at the end of the file.
+	bool read_block(uint64_t offset);
+};
+
+} // namespace bitextor
@@ -0,0 +1,41 @@
+#include "mapped_file.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <util/exception.hh>
+
+namespace bitextor {
+
+MappedFile::MappedFile(std::string const &path)
+: path_(path),
+  data_(nullptr),
+  size_(0) {
+	int fd = open(path.c_str(), O_RDONLY);
+	UTIL_THROW_IF(fd == -1, util::ErrnoException, "Could not open " << path);
+
+	struct stat info;
+	if (fstat(fd, &info) == -1) {
+		close(fd);
+		UTIL_THROW(util::ErrnoException, "Could not determine size of " << path);
+	}
+
+	size_ = info.st_size;
+
+	// mmap does not accept a length of 0, an empty file just has no data.
+	if (size_ > 0) {
+		void *data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		UTIL_THROW_IF(data == MAP_FAILED, util::ErrnoException, "Could not memory map " << path);
+		data_ = static_cast<char const *>(data);
+	} else {
+		close(fd);
+	}
+}
+
+MappedFile::~MappedFile() {
+	if (data_)
+		munmap(const_cast<char *>(data_), size_);
+}
+
+} // namespace bitextor
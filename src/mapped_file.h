@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+
+namespace bitextor {
+
+/**
+ * Read-only memory mapping of a whole file. The mapping stays valid for as
+ * long as the object lives.
+ */
+class MappedFile {
+public:
+	explicit MappedFile(std::string const &path);
+	~MappedFile();
+
+	MappedFile(MappedFile const &other) = delete;
+	MappedFile &operator=(MappedFile const &other) = delete;
+
+	inline char const *data() const { return data_; }
+	inline size_t size() const { return size_; }
+	inline std::string const &path() const { return path_; }
+
+private:
+	std::string path_;
+	char const *data_;
+	size_t size_;
+};
+
+} // namespace bitextor
@@ -1,50 +1,143 @@
 #include "ngram.h"
 #include "murmur_hash.h"
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
 namespace bitextor {
 
-NGramIter::NGramIter() {
+namespace {
+
+inline bool is_delimiter(char c) {
+	// Break on newline as well; I don't care about line beginnings and endings right now
+	return c == ' ' || c == '\n';
+}
+
+/**
+ * Returns the first delimiter in [pos, end), or end if there is none. Tokens
+ * are mostly longer than a few characters, so checks 16 at a time.
+ */
+inline const char *find_delimiter(const char *pos, const char *end) {
+#ifdef __SSE2__
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i newline = _mm_set1_epi8('\n');
+
+	for (; end - pos >= 16; pos += 16) {
+		__m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chars, space), _mm_cmpeq_epi8(chars, newline)));
+		if (mask)
+			return pos + __builtin_ctz(mask);
+	}
+#endif
+
+	while (pos != end && !is_delimiter(*pos))
+		++pos;
+
+	return pos;
+}
+
+/**
+ * Combines the hashes of each run of N consecutive tokens into an ngram hash,
+ * oldest token first. With N known at compile time the inner loop unrolls.
+ */
+template <size_t N> void combine(uint64_t const *tokens, NGram *ngrams, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		uint64_t hash = 0;
+		for (size_t j = 0; j < N; ++j)
+			hash = MurmurHashCombine(tokens[i + j], hash);
+		ngrams[i].hash = hash;
+	}
+}
+
+void combine(uint64_t const *tokens, NGram *ngrams, size_t count, size_t ngram_size) {
+	for (size_t i = 0; i < count; ++i) {
+		uint64_t hash = 0;
+		for (size_t j = 0; j < ngram_size; ++j)
+			hash = MurmurHashCombine(tokens[i + j], hash);
+		ngrams[i].hash = hash;
+	}
+}
+
+} // namespace
+
+constexpr size_t NGramIter::kMaxNGramSize;
+
+constexpr size_t NGramIter::kBatchSize;
+
+NGramIter::NGramIter()
+: pos_(nullptr),
+  end_pos_(nullptr),
+  ngram_size_(0),
+  end_(true),
+  token_cnt_(0),
+  ngram_cnt_(0),
+  ngram_pos_(0) {
 	//
 }
 
 NGramIter::NGramIter(const util::StringPiece &source, size_t ngram_size)
-: token_it_(source, " \n"), // Break on newline as well; I don't care about line beginnings and endings right now
+: pos_(source.data()),
+  end_pos_(source.data() + source.size()),
   ngram_size_(ngram_size),
-  pos_(0),
   end_(false),
-  buffer_(ngram_size) {
-	init();
+  token_cnt_(0),
+  ngram_cnt_(0),
+  ngram_pos_(0) {
+	UTIL_THROW_IF(ngram_size_ < 1 || ngram_size_ > kMaxNGramSize, util::Exception,
+		"ngram size needs to be between 1 and " << kMaxNGramSize << ", not " << ngram_size_);
+
+	fill();
 }
 
-void NGramIter::init() {
-	for (pos_ = 0; pos_ < ngram_size_ - 1 && token_it_; ++pos_, ++token_it_)
-		buffer_[pos_] = MurmurHashNative(token_it_->data(), token_it_->size(), 0);
-	
+/**
+ * Reads and hashes the next batch of tokens, and computes the hashes of all
+ * ngrams that end in that batch. Sets end_ if there are none.
+ */
+void NGramIter::fill() {
+	// The last ngram_size - 1 tokens are the start of the next ngram. On the
+	// first call there are none yet.
+	size_t carry = min(token_cnt_, ngram_size_ - 1);
+	copy(tokens_ + token_cnt_ - carry, tokens_ + token_cnt_, tokens_);
+	token_cnt_ = carry;
+
+	while (token_cnt_ < carry + kBatchSize) {
+		while (pos_ != end_pos_ && is_delimiter(*pos_))
+			++pos_;
+
+		if (pos_ == end_pos_)
+			break;
+
+		const char *token_end = find_delimiter(pos_, end_pos_);
+		tokens_[token_cnt_++] = MurmurHashNative(pos_, token_end - pos_, 0);
+		pos_ = token_end;
+	}
+
 	// Some documents are just too short
-	if (!token_it_)
+	ngram_cnt_ = token_cnt_ >= ngram_size_ ? token_cnt_ - ngram_size_ + 1 : 0;
+	ngram_pos_ = 0;
+
+	if (ngram_cnt_ == 0) {
 		end_ = true;
+		return;
+	}
 
-	increment();
+	switch (ngram_size_) {
+		case 1: combine<1>(tokens_, ngrams_, ngram_cnt_); break;
+		case 2: combine<2>(tokens_, ngrams_, ngram_cnt_); break;
+		case 3: combine<3>(tokens_, ngrams_, ngram_cnt_); break;
+		case 4: combine<4>(tokens_, ngrams_, ngram_cnt_); break;
+		case 5: combine<5>(tokens_, ngrams_, ngram_cnt_); break;
+		default: combine(tokens_, ngrams_, ngram_cnt_, ngram_size_); break;
+	}
 }
 
 void NGramIter::increment() {
-	if (!token_it_) {
-		end_ = true;
-		return;
-	}
-	
-	// Read next word & store hash
-	buffer_[pos_ % ngram_size_] = MurmurHashNative(token_it_->data(), token_it_->size(), 0);
-	
-	// Create hash from combining past N word hashes
-	ngram_.hash = 0;
-	for (long offset = ngram_size_ - 1; offset >= 0; --offset)
-		ngram_.hash = MurmurHashCombine(buffer_[(pos_ - offset) % ngram_size_], ngram_.hash);
-	
-	++pos_;
-	++token_it_;
+	if (++ngram_pos_ == ngram_cnt_)
+		fill();
 }
 
 } // namespace bitextor
@@ -1,7 +1,8 @@
 #pragma once
-#include <vector>
+#include <cstdint>
 #include <boost/iterator/iterator_facade.hpp>
-#include <util/tokenize_piece.hh>
+#include "util/exception.hh"
+#include "util/string_piece.hh"
 
 namespace bitextor {
 
@@ -13,11 +14,19 @@ struct NGram {
 	}
 };
 
+/**
+ * Iterates over the hashes of all ngrams in a text, where tokens are separated
+ * by spaces and newlines. Tokens are read and hashed in batches, and the ngram
+ * hashes of a batch are combined in one go. All state lives in the iterator
+ * itself, so iterating does not allocate.
+ */
 class NGramIter : public boost::iterator_facade<NGramIter, const NGram, boost::forward_traversal_tag> {
 public:
+	static constexpr size_t kMaxNGramSize = 16;
+
 	NGramIter();
 	NGramIter(const util::StringPiece &source, size_t ngram_size);
-	
+
 	inline bool operator!() const {
 		return end_;
 	}
@@ -29,24 +38,35 @@ public:
 private:
 	friend class boost::iterator_core_access;
 
-	util::TokenIter<util::AnyCharacter, true> token_it_;
+	static constexpr size_t kBatchSize = 64;
+
+	// Remaining text
+	const char *pos_;
+	const char *end_pos_;
 
 	size_t ngram_size_;
-	size_t pos_;
 	bool end_;
-	std::vector<uint64_t> buffer_;
-	NGram ngram_;
 
-	void init();
+	// Token hashes of the current batch, preceded by the last ngram_size - 1
+	// tokens of the previous batch.
+	uint64_t tokens_[kMaxNGramSize - 1 + kBatchSize];
+	size_t token_cnt_;
+
+	// Ngram hashes of the current batch
+	NGram ngrams_[kBatchSize];
+	size_t ngram_cnt_;
+	size_t ngram_pos_;
+
+	void fill();
 	void increment();
 
 	inline bool equal(NGramIter const &other) const {
-		return token_it_ == other.token_it_ && end_ == other.end_;
+		return end_ == other.end_ && (end_ || (pos_ == other.pos_ && ngram_pos_ == other.ngram_pos_));
 	}
 
 	inline const NGram &dereference() const {
 		UTIL_THROW_IF(end_, util::OutOfTokens, "We already reached end");
-		return ngram_;
+		return ngrams_[ngram_pos_];
 	}
 };
 
@@ -0,0 +1,297 @@
+#include "ngram_counter.h"
+#include <algorithm>
+#include <queue>
+#include <util/exception.hh>
+
+using namespace std;
+
+namespace bitextor {
+
+namespace {
+
+// Number of entries read from a run at a time while merging
+constexpr size_t kRunBufferSize = 1 << 12;
+
+// Number of runs a counter keeps before merging them into a single run
+constexpr size_t kMaxRuns = 16;
+
+// Slots a counter starts out with
+constexpr size_t kInitialTableSize = 1 << 10;
+
+// A concurrent counter is split into at most this many shards, but shards
+// are kept at least kMinShardSize ngrams large.
+constexpr size_t kMaxShards = 64;
+constexpr size_t kMinShardSize = 1 << 16;
+
+bool ngram_count_order(NGramCount const &a, NGramCount const &b) {
+	return a.ngram.hash < b.ngram.hash;
+}
+
+unique_ptr<FILE, int(*)(FILE*)> make_temp_file() {
+	unique_ptr<FILE, int(*)(FILE*)> file(tmpfile(), &fclose);
+	UTIL_THROW_IF(!file, util::Exception, "Could not create temporary file for spilling ngram counts");
+	return file;
+}
+
+void write_counts(FILE *file, NGramCount const *counts, size_t size) {
+	UTIL_THROW_IF(fwrite(counts, sizeof(NGramCount), size, file) != size,
+		util::Exception, "Could not write " << size << " ngram counts to temporary file");
+}
+
+/**
+ * Reads a sorted run of counts, either from a section of one of the temporary
+ * files or from what was still left in memory.
+ */
+class RunReader {
+public:
+	RunReader(FILE *file, off_t offset, size_t size)
+	: file_(file),
+	  offset_(offset),
+	  remaining_(size),
+	  pos_(0) {
+		fill();
+	}
+
+	explicit RunReader(vector<NGramCount> &&counts)
+	: file_(nullptr),
+	  offset_(0),
+	  remaining_(0),
+	  pos_(0),
+	  buffer_(std::move(counts)) {
+		//
+	}
+
+	inline bool empty() const {
+		return pos_ == buffer_.size();
+	}
+
+	inline NGramCount const &front() const {
+		return buffer_[pos_];
+	}
+
+	void pop() {
+		if (++pos_ == buffer_.size() && remaining_ > 0)
+			fill();
+	}
+
+private:
+	void fill() {
+		// Multiple readers share the same file, so always seek first.
+		UTIL_THROW_IF(fseeko(file_, offset_, SEEK_SET) != 0, util::Exception, "Could not seek in temporary file");
+		buffer_.resize(min(remaining_, kRunBufferSize));
+		UTIL_THROW_IF(fread(buffer_.data(), sizeof(NGramCount), buffer_.size(), file_) != buffer_.size(),
+			util::Exception, "Could not read counts back from temporary file");
+		offset_ += buffer_.size() * sizeof(NGramCount);
+		remaining_ -= buffer_.size();
+		pos_ = 0;
+	}
+
+	FILE *file_;
+	off_t offset_;
+	size_t remaining_;
+	size_t pos_;
+	vector<NGramCount> buffer_;
+};
+
+/**
+ * K-way merge of sorted runs. Calls `callback` once for each unique ngram
+ * with the sum of its counts.
+ */
+void merge_runs(vector<RunReader> &readers, function<void (NGramCount const &)> const &callback) {
+	// Min-heap on the ngram hash at the front of each run
+	auto greater_front = [&readers](size_t a, size_t b) {
+		return readers[a].front().ngram.hash > readers[b].front().ngram.hash;
+	};
+
+	priority_queue<size_t, vector<size_t>, decltype(greater_front)> heap(greater_front);
+
+	for (size_t i = 0; i < readers.size(); ++i)
+		if (!readers[i].empty())
+			heap.push(i);
+
+	while (!heap.empty()) {
+		NGramCount total{readers[heap.top()].front().ngram, 0};
+
+		// Sum the counts of this ngram across all runs. Each run contains each
+		// ngram at most once, and all runs are sorted by hash.
+		while (!heap.empty() && readers[heap.top()].front().ngram == total.ngram) {
+			size_t i = heap.top();
+			heap.pop();
+
+			total.count += readers[i].front().count;
+			readers[i].pop();
+
+			if (!readers[i].empty())
+				heap.push(i);
+		}
+
+		callback(total);
+	}
+}
+
+} // namespace
+
+constexpr size_t ConcurrentNGramCounter::kBufferSize;
+
+NGramCounter::NGramCounter(size_t max_size)
+: max_size_(max(max_size, size_t(1))),
+  file_(nullptr, &fclose) {
+	clear();
+}
+
+void NGramCounter::clear() {
+	// Assign new vectors to also give back the memory of a grown table
+	keys_ = vector<uint64_t>(kInitialTableSize, 0);
+	counts_ = vector<uint32_t>(kInitialTableSize, 0);
+	mask_ = kInitialTableSize - 1;
+	size_ = 0;
+	zero_count_ = 0;
+}
+
+void NGramCounter::grow() {
+	vector<uint64_t> keys(keys_.size() * 2, 0);
+	vector<uint32_t> counts(counts_.size() * 2, 0);
+	size_t mask = keys.size() - 1;
+
+	for (size_t i = 0; i < keys_.size(); ++i) {
+		if (keys_[i] == 0)
+			continue;
+
+		size_t slot = keys_[i] & mask;
+		while (keys[slot] != 0)
+			slot = (slot + 1) & mask;
+
+		keys[slot] = keys_[i];
+		counts[slot] = counts_[i];
+	}
+
+	keys_.swap(keys);
+	counts_.swap(counts);
+	mask_ = mask;
+}
+
+vector<NGramCount> NGramCounter::sorted_counts() const {
+	vector<NGramCount> sorted;
+	sorted.reserve(size_);
+
+	if (zero_count_ > 0)
+		sorted.push_back(NGramCount{NGram{0}, zero_count_});
+
+	for (size_t i = 0; i < keys_.size(); ++i)
+		if (keys_[i] != 0)
+			sorted.push_back(NGramCount{NGram{keys_[i]}, counts_[i]});
+
+	sort(sorted.begin(), sorted.end(), &ngram_count_order);
+	return sorted;
+}
+
+void NGramCounter::spill() {
+	if (!file_)
+		file_ = make_temp_file();
+
+	vector<NGramCount> sorted(sorted_counts());
+
+	UTIL_THROW_IF(fseeko(file_.get(), 0, SEEK_END) != 0, util::Exception, "Could not seek in temporary file");
+	runs_.push_back(Run{ftello(file_.get()), sorted.size()});
+	write_counts(file_.get(), sorted.data(), sorted.size());
+
+	clear();
+
+	if (runs_.size() >= kMaxRuns)
+		compact();
+}
+
+void NGramCounter::compact() {
+	vector<RunReader> readers;
+	readers.reserve(runs_.size());
+	for (Run const &run : runs_)
+		readers.emplace_back(file_.get(), run.offset, run.size);
+
+	unique_ptr<FILE, int(*)(FILE*)> file(make_temp_file());
+	size_t size = 0;
+
+	merge_runs(readers, [&file, &size](NGramCount const &entry) {
+		write_counts(file.get(), &entry, 1);
+		++size;
+	});
+
+	file_ = std::move(file);
+	runs_.assign(1, Run{0, size});
+}
+
+void NGramCounter::merge(vector<NGramCounter *> const &counters, function<void (NGramCount const &)> const &callback) {
+	vector<RunReader> readers;
+
+	for (NGramCounter *counter : counters) {
+		for (NGramCounter::Run const &run : counter->runs_)
+			readers.emplace_back(counter->file_.get(), run.offset, run.size);
+
+		if (counter->size_ > 0)
+			readers.emplace_back(counter->sorted_counts());
+
+		counter->clear();
+	}
+
+	merge_runs(readers, callback);
+
+	for (NGramCounter *counter : counters) {
+		counter->runs_.clear();
+		counter->file_.reset();
+	}
+}
+
+void merge_counts(vector<NGramCounter> &counters, function<void (NGramCount const &)> callback) {
+	vector<NGramCounter *> pointers;
+	for (NGramCounter &counter : counters)
+		pointers.push_back(&counter);
+
+	NGramCounter::merge(pointers, callback);
+}
+
+ConcurrentNGramCounter::ConcurrentNGramCounter(size_t max_size, size_t worker_cnt) {
+	size_t shard_cnt = 1;
+	while (shard_cnt * 2 <= kMaxShards && max_size / (shard_cnt * 2) >= kMinShardSize)
+		shard_cnt *= 2;
+
+	for (size_t i = 0; i < shard_cnt; ++i)
+		shards_.emplace_back(new Shard(max_size / shard_cnt));
+
+	buffers_.resize(max(worker_cnt, size_t(1)) * shard_cnt);
+	for (vector<NGram> &buffer : buffers_)
+		buffer.reserve(kBufferSize);
+}
+
+void ConcurrentNGramCounter::flush(vector<NGram> &buffer, size_t shard) {
+	{
+		lock_guard<mutex> lock(shards_[shard]->mutex);
+		for (NGram const &ngram : buffer)
+			shards_[shard]->counter.add(ngram);
+	}
+
+	buffer.clear();
+}
+
+size_t ConcurrentNGramCounter::runs() const {
+	size_t runs = 0;
+	for (auto const &shard : shards_)
+		runs += shard->counter.runs();
+	return runs;
+}
+
+void ConcurrentNGramCounter::flush() {
+	for (size_t i = 0; i < buffers_.size(); ++i)
+		if (!buffers_[i].empty())
+			flush(buffers_[i], i % shards_.size());
+}
+
+void ConcurrentNGramCounter::merge(function<void (NGramCount const &)> callback) {
+	flush();
+
+	vector<NGramCounter *> counters;
+	for (auto const &shard : shards_)
+		counters.push_back(&shard->counter);
+
+	NGramCounter::merge(counters, callback);
+}
+
+} // namespace bitextor
@@ -0,0 +1,161 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <sys/types.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "ngram.h"
+
+namespace bitextor {
+
+struct NGramCount {
+	NGram ngram;
+	size_t count;
+};
+
+/**
+ * Counts ngrams in memory until it holds `max_size` unique ngrams, at which
+ * point the counts are sorted by hash and spilled to a temporary file as a
+ * run. Merging the runs of one or more counters gives the total counts.
+ * All runs of a counter go into the same file, and once there are too many of
+ * them they are merged into one to keep the number of runs read in parallel
+ * during the final merge bounded.
+ *
+ * The counts are kept in an open-addressing table on the ngram hash, which
+ * costs 12 bytes per slot and grows as more unique ngrams come in. Counts are
+ * 32 bits, which is plenty for the number of documents containing an ngram.
+ */
+class NGramCounter {
+public:
+	explicit NGramCounter(size_t max_size);
+
+	inline void add(NGram const &ngram, size_t count = 1) {
+		// Hash 0 marks an empty slot, so that ngram is counted on the side
+		if (ngram.hash == 0) {
+			size_ += zero_count_ == 0;
+			zero_count_ += count;
+		} else {
+			size_t slot = ngram.hash & mask_;
+			while (keys_[slot] != ngram.hash && keys_[slot] != 0)
+				slot = (slot + 1) & mask_;
+
+			if (keys_[slot] == 0) {
+				keys_[slot] = ngram.hash;
+				++size_;
+			}
+
+			counts_[slot] += count;
+		}
+
+		if (size_ >= max_size_)
+			spill();
+		else if (size_ > keys_.size() / 4 * 3)
+			grow();
+	}
+
+	// Number of unique ngrams currently in memory
+	inline size_t size() const {
+		return size_;
+	}
+
+	// Number of runs currently on disk
+	inline size_t runs() const {
+		return runs_.size();
+	}
+
+private:
+	friend class ConcurrentNGramCounter;
+	friend void merge_counts(std::vector<NGramCounter> &, std::function<void (NGramCount const &)>);
+
+	// Position of a sorted run of counts in the temporary file
+	struct Run {
+		off_t offset;
+		size_t size;
+	};
+
+	void spill();
+	void compact();
+	void grow();
+	void clear();
+	std::vector<NGramCount> sorted_counts() const;
+
+	static void merge(std::vector<NGramCounter *> const &counters, std::function<void (NGramCount const &)> const &callback);
+
+	size_t max_size_;
+
+	// Hash table with linear probing, a power of two in size
+	std::vector<uint64_t> keys_;
+	std::vector<uint32_t> counts_;
+	size_t mask_;
+	size_t size_;
+	size_t zero_count_;
+
+	std::unique_ptr<std::FILE, int(*)(std::FILE*)> file_;
+	std::vector<Run> runs_;
+};
+
+/**
+ * NGramCounter that several workers add to at the same time. It is split up
+ * into shards on the top bits of the ngram hash, each with their own lock, so
+ * every unique ngram is counted in a single place: memory grows with the
+ * number of unique ngrams and not with the number of workers. Each worker
+ * collects its ngrams per shard, and adds them to the shard under one lock
+ * once it has a buffer full.
+ */
+class ConcurrentNGramCounter {
+public:
+	// Ngrams a worker collects for a shard before adding them
+	static constexpr size_t kBufferSize = 1024;
+
+	// Counts for at most `max_size` unique ngrams in memory over all shards,
+	// added to by workers 0 to `worker_cnt` - 1.
+	ConcurrentNGramCounter(size_t max_size, size_t worker_cnt);
+
+	inline void add(size_t worker, NGram const &ngram) {
+		size_t shard = (ngram.hash >> 32) * shards_.size() >> 32;
+		std::vector<NGram> &buffer = buffers_[worker * shards_.size() + shard];
+		buffer.push_back(ngram);
+
+		if (buffer.size() == kBufferSize)
+			flush(buffer, shard);
+	}
+
+	// Adds what is left in the buffers of all workers. Only call once they
+	// are done adding.
+	void flush();
+
+	// Runs on disk over all shards. Only valid while nobody adds.
+	size_t runs() const;
+
+	// Flushes, and merges the counts of all shards like merge_counts().
+	void merge(std::function<void (NGramCount const &)> callback);
+
+private:
+	struct Shard {
+		std::mutex mutex;
+		NGramCounter counter;
+
+		explicit Shard(size_t max_size)
+		: counter(max_size) {
+			//
+		}
+	};
+
+	std::vector<std::unique_ptr<Shard>> shards_;
+
+	// Buffer of each worker for each shard
+	std::vector<std::vector<NGram>> buffers_;
+
+	void flush(std::vector<NGram> &buffer, size_t shard);
+};
+
+/**
+ * Merges the spilled runs and in-memory counts of all counters, summing the
+ * counts of each ngram. Calls `callback` once per unique ngram, in order of
+ * ngram hash. Consumes the counters.
+ */
+void merge_counts(std::vector<NGramCounter> &counters, std::function<void (NGramCount const &)> callback);
+
+} // namespace bitextor
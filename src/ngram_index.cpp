@@ -0,0 +1,308 @@
+#include "ngram_index.h"
+#include "index_file.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <util/exception.hh>
+
+using namespace std;
+
+namespace bitextor {
+
+namespace {
+
+// Smallest power of two table that keeps the load factor at or below 50%. At
+// least two slots, so the shift that finds the home slot stays below 64.
+size_t table_size(size_t keys) {
+	size_t size = 2;
+	while (size < 2 * keys)
+		size <<= 1;
+	return size;
+}
+
+// Shift that turns a hash into a slot in a table of size slots
+unsigned table_shift(size_t size) {
+	unsigned shift = 64;
+	while (size > 1) {
+		size >>= 1;
+		--shift;
+	}
+	return shift;
+}
+
+// Finds the empty slot for hash, going no further than end. Returns end if
+// there is none before it.
+size_t find_empty_slot(vector<uint32_t> const &table, unsigned shift, size_t end, uint64_t hash) {
+	size_t pos = hash >> shift;
+	while (pos < end && table[pos] != NGramIndex::kEmptySlot)
+		++pos;
+	return pos;
+}
+
+/**
+ * Part of the index for the ngrams of one shard, with positions relative to
+ * the shard.
+ */
+struct IndexShard {
+	std::vector<IndexEntry> entries;
+	std::vector<uint64_t> keys;
+	std::vector<size_t> offsets;
+
+	// Keys whose slot is past the region of the table of this shard
+	std::vector<uint32_t> overflow;
+};
+
+} // namespace
+
+constexpr size_t IndexBuilder::kShardBits;
+constexpr size_t IndexBuilder::kShards;
+constexpr uint32_t NGramIndex::kEmptySlot;
+
+IndexBuilder::IndexBuilder(size_t workers)
+: workers_(workers),
+  shards_(workers * kShards) {
+	//
+}
+
+NGramIndex::NGramIndex()
+: offsets_(vector<size_t>(1, 0)),
+  table_(vector<uint32_t>(table_size(0), kEmptySlot)),
+  mask_(table_.size() - 1),
+  shift_(table_shift(table_.size())),
+  posting_cnt_(0),
+  code_bytes_(0) {
+	//
+}
+
+NGramIndex::NGramIndex(IndexBuilder &&builder, ThreadPool &pool)
+: posting_cnt_(0),
+  code_bytes_(0) {
+	vector<IndexShard> shards(IndexBuilder::kShards);
+
+	// Gather the entries of each shard from all workers, and sort them by
+	// ngram and then document. That yields the keys of the shard in order, and
+	// the postings of each key in the order the index keeps them.
+	for (size_t shard = 0; shard < shards.size(); ++shard) {
+		pool.submit([&builder, &shards, shard](size_t) {
+			IndexShard &out = shards[shard];
+
+			size_t entry_cnt = 0;
+			for (size_t worker = 0; worker < builder.workers_; ++worker)
+				entry_cnt += builder.shards_[worker * IndexBuilder::kShards + shard].size();
+
+			out.entries.reserve(entry_cnt);
+			for (size_t worker = 0; worker < builder.workers_; ++worker) {
+				vector<IndexEntry> &entries = builder.shards_[worker * IndexBuilder::kShards + shard];
+				out.entries.insert(out.entries.end(), entries.begin(), entries.end());
+				vector<IndexEntry>().swap(entries);
+			}
+
+			sort(out.entries.begin(), out.entries.end(), [](IndexEntry const &a, IndexEntry const &b) {
+				return a.ngram.hash < b.ngram.hash || (a.ngram.hash == b.ngram.hash && a.doc_id < b.doc_id);
+			});
+
+			for (size_t i = 0; i < out.entries.size(); ++i) {
+				if (i == 0 || out.entries[i].ngram.hash != out.entries[i - 1].ngram.hash) {
+					out.keys.push_back(out.entries[i].ngram.hash);
+					out.offsets.push_back(i);
+				}
+			}
+		});
+	}
+
+	pool.wait();
+
+	// Shards cover consecutive ranges of hashes, so their keys follow each
+	// other in order.
+	vector<size_t> key_begin(shards.size() + 1, 0);
+	vector<size_t> entry_begin(shards.size() + 1, 0);
+	for (size_t shard = 0; shard < shards.size(); ++shard) {
+		key_begin[shard + 1] = key_begin[shard] + shards[shard].keys.size();
+		entry_begin[shard + 1] = entry_begin[shard] + shards[shard].entries.size();
+	}
+
+	UTIL_THROW_IF(key_begin.back() >= kEmptySlot, util::Exception, "Too many unique ngrams for the index");
+
+	vector<uint64_t> keys(key_begin.back());
+	vector<size_t> offsets(key_begin.back() + 1);
+	vector<float> bounds(key_begin.back(), 0);
+	vector<Posting> postings(entry_begin.back());
+	vector<uint32_t> table(table_size(keys.size()), kEmptySlot);
+	unsigned shift = table_shift(table.size());
+
+	offsets.back() = postings.size();
+
+	// Copy each shard into place and fill its region of the table. The keys of
+	// a shard have their home slot in that region, but might run past its end.
+	// Those are inserted afterwards, as the next region is not ours to write.
+	for (size_t shard = 0; shard < shards.size(); ++shard) {
+		pool.submit([&, shard](size_t) {
+			IndexShard &in = shards[shard];
+			size_t region_end = (shard + 1) * table.size() / IndexBuilder::kShards;
+
+			for (size_t i = 0; i < in.keys.size(); ++i) {
+				uint32_t key = key_begin[shard] + i;
+				keys[key] = in.keys[i];
+				offsets[key] = entry_begin[shard] + in.offsets[i];
+
+				size_t pos = find_empty_slot(table, shift, region_end, in.keys[i]);
+				if (pos < region_end)
+					table[pos] = key;
+				else
+					in.overflow.push_back(key);
+			}
+
+			for (size_t i = 0; i < in.entries.size(); ++i)
+				postings[entry_begin[shard] + i] = Posting{in.entries[i].doc_id, in.entries[i].tfidf};
+
+			for (size_t i = 0; i < in.keys.size(); ++i) {
+				size_t end = i + 1 < in.keys.size() ? in.offsets[i + 1] : in.entries.size();
+				for (size_t j = in.offsets[i]; j < end; ++j)
+					bounds[key_begin[shard] + i] = max(bounds[key_begin[shard] + i], abs(in.entries[j].tfidf));
+			}
+
+			vector<IndexEntry>().swap(in.entries);
+			vector<uint64_t>().swap(in.keys);
+			vector<size_t>().swap(in.offsets);
+		});
+	}
+
+	pool.wait();
+
+	size_t mask = table.size() - 1;
+	for (IndexShard const &shard : shards) {
+		for (uint32_t key : shard.overflow) {
+			size_t pos = keys[key] >> shift;
+			while (table[pos] != kEmptySlot)
+				pos = (pos + 1) & mask;
+			table[pos] = key;
+		}
+	}
+
+	keys_ = FlatArray<uint64_t>(std::move(keys));
+	offsets_ = FlatArray<size_t>(std::move(offsets));
+	postings_ = FlatArray<Posting>(std::move(postings));
+	table_ = FlatArray<uint32_t>(std::move(table));
+	mask_ = mask;
+	shift_ = shift;
+	posting_cnt_ = postings_.size();
+	bounds_ = FlatArray<float>(std::move(bounds));
+}
+
+NGramIndex::NGramIndex(IndexReader &reader)
+: keys_(reader.read_array<uint64_t>()),
+  offsets_(reader.read_array<size_t>()),
+  postings_(reader.read_array<Posting>()),
+  table_(reader.read_array<uint32_t>()),
+  mask_(table_.size() - 1),
+  shift_(table_shift(table_.size())),
+  posting_cnt_(reader.read_value<uint64_t>()),
+  packed_postings_(reader.read_array<uint8_t>()),
+  codebook_(reader.read_array<float>()),
+  code_bytes_(codebook_.size() > 256 ? 2 : 1),
+  bounds_(reader.read_array<float>()) {
+	UTIL_THROW_IF(offsets_.size() != keys_.size() + 1
+		|| offsets_[keys_.size()] != (packed() ? packed_postings_.size() : postings_.size())
+		|| (!packed() && posting_cnt_ != postings_.size())
+		|| (packed() && codebook_.size() != 256 && codebook_.size() != 65536)
+		|| table_.size() < 2
+		|| (table_.size() & mask_) != 0
+		|| bounds_.size() != keys_.size(),
+		util::Exception, "Reference index in index file is inconsistent");
+}
+
+void NGramIndex::write(IndexWriter &writer) const {
+	writer.write_array(keys_);
+	writer.write_array(offsets_);
+	writer.write_array(postings_);
+	writer.write_array(table_);
+	writer.write_value<uint64_t>(posting_cnt_);
+	writer.write_array(packed_postings_);
+	writer.write_array(codebook_);
+	writer.write_array(bounds_);
+}
+
+void NGramIndex::pack(unsigned bits) {
+	float min_score = numeric_limits<float>::max(), max_score = 0;
+	for (Posting const &posting : postings_) {
+		if (posting.tfidf > 0) {
+			min_score = min(min_score, posting.tfidf);
+			max_score = max(max_score, posting.tfidf);
+		}
+	}
+
+	pack(bits, min_score, max_score);
+}
+
+void NGramIndex::pack(unsigned bits, float min_score, float max_score) {
+	UTIL_THROW_IF(bits != 8 && bits != 16, util::Exception, "Postings can be packed with 8 or 16 bit scores, not " << bits);
+	UTIL_THROW_IF(packed(), util::Exception, "Postings are already packed");
+
+	ScoreQuantizer quantizer(min_score, max_score, bits);
+	vector<float> codebook(quantizer.codebook());
+
+	vector<uint8_t> packed;
+	vector<size_t> offsets(keys_.size() + 1);
+
+	// Bounds of the scores as they are decoded
+	vector<float> bounds(keys_.size(), 0);
+
+	for (size_t key = 0; key < keys_.size(); ++key) {
+		offsets[key] = packed.size();
+		write_varint(offsets_[key + 1] - offsets_[key], packed);
+
+		uint32_t doc_id = 0;
+		for (size_t i = offsets_[key]; i < offsets_[key + 1]; ++i) {
+			write_varint(postings_[i].doc_id - doc_id, packed);
+			doc_id = postings_[i].doc_id;
+
+			uint32_t code = quantizer.encode(postings_[i].tfidf);
+			for (unsigned byte = 0; byte < bits / 8; ++byte)
+				packed.push_back(static_cast<uint8_t>(code >> (8 * byte)));
+
+			bounds[key] = max(bounds[key], abs(codebook[code]));
+		}
+	}
+
+	offsets.back() = packed.size();
+	packed.shrink_to_fit();
+
+	offsets_ = FlatArray<size_t>(std::move(offsets));
+	postings_ = FlatArray<Posting>();
+	packed_postings_ = FlatArray<uint8_t>(std::move(packed));
+	codebook_ = FlatArray<float>(std::move(codebook));
+	code_bytes_ = bits / 8;
+	bounds_ = FlatArray<float>(std::move(bounds));
+}
+
+size_t NGramIndex::memory_usage() const {
+	return keys_.size() * sizeof(uint64_t)
+	     + offsets_.size() * sizeof(size_t)
+	     + postings_.size() * sizeof(Posting)
+	     + table_.size() * sizeof(uint32_t)
+	     + packed_postings_.size()
+	     + codebook_.size() * sizeof(float)
+	     + bounds_.size() * sizeof(float);
+}
+
+std::vector<size_t> NGramIndex::list_size_histogram() const {
+	std::vector<size_t> histogram;
+
+	for (uint32_t key = 0; key < keys_.size(); ++key) {
+		size_t size = packed() ? packed_postings(key).size() : postings(key).size();
+
+		size_t bucket = 0;
+		while (size >> (bucket + 1))
+			++bucket;
+
+		if (histogram.size() <= bucket)
+			histogram.resize(bucket + 1, 0);
+
+		++histogram[bucket];
+	}
+
+	return histogram;
+}
+
+} // namespace bitextor
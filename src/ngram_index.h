@@ -0,0 +1,191 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "flat_array.h"
+#include "ngram.h"
+#include "packed_postings.h"
+
+namespace bitextor {
+
+class IndexReader;
+class IndexWriter;
+class ThreadPool;
+
+/**
+ * Single occurrence of an ngram in a reference document, as collected by the
+ * threads that load the reference documents.
+ */
+struct IndexEntry {
+	NGram ngram;
+	uint32_t doc_id;
+	float tfidf;
+};
+
+/**
+ * Collects the entries for an NGramIndex from several workers at once. Each
+ * worker spreads its entries over shards by the top bits of the ngram hash,
+ * so every shard covers its own range of hashes and can be turned into its
+ * part of the index independently of the others.
+ */
+class IndexBuilder {
+public:
+	explicit IndexBuilder(size_t workers);
+
+	inline void add(size_t worker, IndexEntry const &entry) {
+		shards_[worker * kShards + (entry.ngram.hash >> (64 - kShardBits))].push_back(entry);
+	}
+
+	static constexpr size_t kShardBits = 8;
+	static constexpr size_t kShards = size_t(1) << kShardBits;
+
+private:
+	size_t workers_;
+
+	// Entries of worker w for shard s are at w * kShards + s
+	std::vector<std::vector<IndexEntry>> shards_;
+
+	friend class NGramIndex;
+};
+
+/**
+ * Inverted index from ngram to the documents it occurs in, stored as flat
+ * arrays: sorted ngram keys, an offset per key into a single array of packed
+ * postings, and an open-addressing hash table on the keys for lookups. Each
+ * list of postings is sorted by document id.
+ *
+ * The hash table places keys by the top bits of their hash, so sorted keys
+ * fill the table from front to back, and the keys of each shard of an
+ * IndexBuilder land in their own region of it.
+ *
+ * After pack(), the postings are stored as PackedPostingLists instead, and the
+ * offsets point into those bytes. Such an index is looked up with
+ * find_packed() rather than find().
+ *
+ * For each ngram the index also keeps the largest absolute tfidf in its
+ * postings, which bounds what the ngram can add to the score of any document.
+ */
+class NGramIndex {
+public:
+	struct Posting {
+		uint32_t doc_id;
+		float tfidf;
+	};
+
+	class PostingList {
+	public:
+		PostingList()
+		: begin_(nullptr),
+		  end_(nullptr) {
+			//
+		}
+
+		PostingList(Posting const *begin, Posting const *end)
+		: begin_(begin),
+		  end_(end) {
+			//
+		}
+
+		inline Posting const *begin() const { return begin_; }
+		inline Posting const *end() const { return end_; }
+		inline size_t size() const { return end_ - begin_; }
+		inline bool empty() const { return begin_ == end_; }
+
+	private:
+		Posting const *begin_;
+		Posting const *end_;
+	};
+
+	NGramIndex();
+
+	// Builds the index from the entries of a builder, one shard per task on
+	// pool. Consumes the entries. The result only depends on the entries, not
+	// on which worker added them.
+	NGramIndex(IndexBuilder &&builder, ThreadPool &pool);
+
+	// Index that points directly into a memory mapped index file
+	explicit NGramIndex(IndexReader &reader);
+
+	void write(IndexWriter &writer) const;
+
+	// Replaces the postings by delta encoded doc ids and scores quantized to
+	// bits bits (8 or 16), which takes a fraction of the memory.
+	void pack(unsigned bits);
+
+	// Same, but with codes spread over the positive scores in [min_score,
+	// max_score] instead of those in the index, so that indexes of different
+	// documents can share the same codes.
+	void pack(unsigned bits, float min_score, float max_score);
+
+	inline bool packed() const { return !codebook_.empty(); }
+
+	// Postings of ngram, or an empty list if it does not occur in the index.
+	inline PostingList find(NGram const &ngram) const {
+		uint32_t key = lookup(ngram);
+		return key == kEmptySlot ? PostingList() : postings(key);
+	}
+
+	// Same for a packed index
+	inline PackedPostingList find_packed(NGram const &ngram) const {
+		uint32_t key = lookup(ngram);
+		return key == kEmptySlot ? PackedPostingList() : packed_postings(key);
+	}
+
+	// Position of ngram in the keys, or kEmptySlot if it is not in the index
+	inline uint32_t lookup(NGram const &ngram) const {
+		for (size_t slot = ngram.hash >> shift_; table_[slot] != kEmptySlot; slot = (slot + 1) & mask_)
+			if (keys_[table_[slot]] == ngram.hash)
+				return table_[slot];
+
+		return kEmptySlot;
+	}
+
+	// Postings of the ngram at position key
+	inline PostingList postings(uint32_t key) const {
+		return PostingList(&postings_[offsets_[key]], &postings_[offsets_[key + 1]]);
+	}
+
+	inline PackedPostingList packed_postings(uint32_t key) const {
+		return PackedPostingList(&packed_postings_[offsets_[key]], codebook_.data(), code_bytes_);
+	}
+
+	// Largest absolute tfidf in the postings of the ngram at position key
+	inline float bound(uint32_t key) const {
+		return bounds_[key];
+	}
+
+	// Number of unique ngrams in the index
+	inline size_t size() const { return keys_.size(); }
+
+	// Total number of postings in the index
+	inline size_t postings() const { return posting_cnt_; }
+
+	// Bytes used by the arrays of the index
+	size_t memory_usage() const;
+
+	// Number of ngrams by the length of their posting list: entry i counts
+	// the lists of 2^i up to 2^(i+1) - 1 postings.
+	std::vector<size_t> list_size_histogram() const;
+
+	static constexpr uint32_t kEmptySlot = UINT32_MAX;
+
+private:
+	FlatArray<uint64_t> keys_;
+	FlatArray<size_t> offsets_;
+	FlatArray<Posting> postings_;
+	FlatArray<uint32_t> table_;
+	size_t mask_;
+
+	// Turns a hash into its slot in the table
+	unsigned shift_;
+
+	size_t posting_cnt_;
+
+	// Postings after pack(), and the score of each code
+	FlatArray<uint8_t> packed_postings_;
+	FlatArray<float> codebook_;
+	unsigned code_bytes_;
+
+	FlatArray<float> bounds_;
+};
+
+} // namespace bitextor
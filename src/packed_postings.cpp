@@ -0,0 +1,38 @@
+#include "packed_postings.h"
+#include <cmath>
+#include <util/exception.hh>
+
+using namespace std;
+
+namespace bitextor {
+
+ScoreQuantizer::ScoreQuantizer(float min, float max, unsigned bits)
+: log_min_(log(min)),
+  step_(0),
+  max_code_((uint32_t(1) << bits) - 1) {
+	UTIL_THROW_IF(bits < 2 || bits > 16, util::Exception, "Cannot quantize scores to " << bits << " bits");
+
+	// Codes 1 to max_code_ cover [min, max]
+	if (max > min && max_code_ > 1)
+		step_ = (log(max) - log_min_) / (max_code_ - 1);
+}
+
+uint32_t ScoreQuantizer::encode(float score) const {
+	if (!(score > 0))
+		return 0;
+
+	if (step_ == 0)
+		return 1;
+
+	float code = round((log(score) - log_min_) / step_);
+	return 1 + static_cast<uint32_t>(std::min(std::max(code, 0.0f), float(max_code_ - 1)));
+}
+
+vector<float> ScoreQuantizer::codebook() const {
+	vector<float> scores(max_code_ + 1, 0);
+	for (uint32_t code = 1; code <= max_code_; ++code)
+		scores[code] = exp(log_min_ + (code - 1) * step_);
+	return scores;
+}
+
+} // namespace bitextor
@@ -0,0 +1,100 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace bitextor {
+
+/**
+ * Variable length encoding of unsigned integers, seven bits per byte, lowest
+ * bits first. The high bit of a byte tells whether another byte follows.
+ */
+inline void write_varint(uint32_t value, std::vector<uint8_t> &out) {
+	while (value >= 0x80) {
+		out.push_back(static_cast<uint8_t>(value) | 0x80);
+		value >>= 7;
+	}
+	out.push_back(static_cast<uint8_t>(value));
+}
+
+inline uint8_t const *read_varint(uint8_t const *in, uint32_t &value) {
+	value = *in & 0x7F;
+	for (unsigned shift = 7; *in++ & 0x80; shift += 7)
+		value |= uint32_t(*in & 0x7F) << shift;
+	return in;
+}
+
+/**
+ * Maps tfidf scores onto 2^bits codes. Scores are spaced logarithmically
+ * between the smallest and largest positive score, so every code has about
+ * the same relative error. Code 0 stands for all scores of 0 and below, which
+ * only ngrams that occur in nearly every document get.
+ */
+class ScoreQuantizer {
+public:
+	ScoreQuantizer(float min, float max, unsigned bits);
+
+	uint32_t encode(float score) const;
+
+	// Score for each code
+	std::vector<float> codebook() const;
+
+private:
+	float log_min_;
+	float step_;
+	uint32_t max_code_;
+};
+
+/**
+ * Posting list of an NGramIndex with packed postings: the number of postings
+ * followed by, for each posting, the gap to the previous doc id as a varint
+ * and the code of its score in code_bytes bytes. Read front to back, like the
+ * scorer does.
+ */
+class PackedPostingList {
+public:
+	PackedPostingList()
+	: pos_(nullptr),
+	  remaining_(0),
+	  doc_id_(0),
+	  codebook_(nullptr),
+	  code_bytes_(0) {
+		//
+	}
+
+	PackedPostingList(uint8_t const *data, float const *codebook, unsigned code_bytes)
+	: doc_id_(0),
+	  codebook_(codebook),
+	  code_bytes_(code_bytes) {
+		pos_ = read_varint(data, remaining_);
+	}
+
+	inline bool empty() const { return remaining_ == 0; }
+
+	inline size_t size() const { return remaining_; }
+
+	// Calls fun(doc_id, tfidf) for each of the next postings with a doc id
+	// below end, and skips past them.
+	template <typename F> inline void read_until(size_t end, F fun) {
+		while (remaining_ > 0) {
+			uint32_t gap;
+			uint8_t const *code = read_varint(pos_, gap);
+			if (size_t(doc_id_) + gap >= end)
+				return;
+
+			doc_id_ += gap;
+			fun(doc_id_, codebook_[code_bytes_ == 1 ? code[0] : code[0] | uint32_t(code[1]) << 8]);
+			pos_ = code + code_bytes_;
+			--remaining_;
+		}
+	}
+
+private:
+	uint8_t const *pos_;
+	uint32_t remaining_;
+	uint32_t doc_id_;
+	float const *codebook_;
+	unsigned code_bytes_;
+};
+
+} // namespace bitextor
@@ -0,0 +1,51 @@
+#include "pair_file.h"
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <util/exception.hh>
+
+using namespace std;
+
+namespace bitextor {
+
+void write_pair_file(string const &path, PairFileHeader header, vector<DocumentPair> const &pairs) {
+	memcpy(header.magic, kPairFileMagic, sizeof(kPairFileMagic));
+	header.version = kPairFileVersion;
+	header.pair_cnt = pairs.size();
+
+	UTIL_THROW_IF(header.in_document_cnt > UINT32_MAX || header.en_document_cnt > UINT32_MAX, util::Exception,
+		"Too many documents to write pairs of to " << path);
+
+	unique_ptr<FILE, int(*)(FILE*)> file(fopen(path.c_str(), "wb"), &fclose);
+	UTIL_THROW_IF(!file, util::ErrnoException, "Could not open " << path << " for writing");
+
+	bool ok = fwrite(&header, sizeof(header), 1, file.get()) == 1;
+
+	for (DocumentPair const &pair : pairs) {
+		StoredPair stored{pair.score, static_cast<uint32_t>(pair.in_idx), static_cast<uint32_t>(pair.en_idx)};
+		ok = ok && fwrite(&stored, sizeof(stored), 1, file.get()) == 1;
+	}
+
+	ok = ok && fclose(file.release()) == 0;
+	UTIL_THROW_IF(!ok, util::ErrnoException, "Could not write to " << path);
+}
+
+PairFile::PairFile(string const &path)
+: file_(path) {
+	UTIL_THROW_IF(file_.size() < sizeof(header_), util::Exception, path << " is not a pair file");
+	memcpy(&header_, file_.data(), sizeof(header_));
+
+	UTIL_THROW_IF(memcmp(header_.magic, kPairFileMagic, sizeof(kPairFileMagic)) != 0, util::Exception,
+		path << " is not a pair file");
+	UTIL_THROW_IF(header_.version != kPairFileVersion, util::Exception, path << " is a pair file of version "
+		<< header_.version << " but this version reads " << kPairFileVersion);
+	UTIL_THROW_IF(header_.shard < 1 || header_.shard > header_.shard_cnt, util::Exception,
+		path << " has an invalid shard number");
+	UTIL_THROW_IF(file_.size() != sizeof(header_) + header_.pair_cnt * sizeof(StoredPair), util::Exception,
+		path << " is truncated");
+
+	// The header is a multiple of 8 bytes, so the pairs are aligned
+	pairs_ = reinterpret_cast<StoredPair const *>(file_.data() + sizeof(header_));
+}
+
+} // namespace bitextor
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "document_pair.h"
+#include "mapped_file.h"
+
+namespace bitextor {
+
+/**
+ * Start of a file written by `docalign --write-pairs`, followed by pair_cnt
+ * StoredPairs sorted from best to worst (see better_pair). Like the index
+ * file, it is in native byte order.
+ */
+struct PairFileHeader {
+	char magic[8];
+	uint32_t version;
+
+	// Which of the English documents were scored: every shard_cnt-th one,
+	// starting at shard (counting from 1).
+	uint32_t shard;
+	uint32_t shard_cnt;
+	uint32_t reserved;
+
+	uint64_t in_document_cnt;
+	uint64_t en_document_cnt;
+	uint64_t pair_cnt;
+};
+
+struct StoredPair {
+	float score;
+	uint32_t in_idx;
+	uint32_t en_idx;
+};
+
+// Increase whenever the layout of the pair file changes
+constexpr uint32_t kPairFileVersion = 1;
+
+constexpr char kPairFileMagic[8] = {'D', 'O', 'C', 'P', 'A', 'I', 'R', 'S'};
+
+// Writes pairs, which need to be sorted already, after header. Fills in the
+// magic, version and pair count of the header.
+void write_pair_file(std::string const &path, PairFileHeader header, std::vector<DocumentPair> const &pairs);
+
+/**
+ * Pair file, memory mapped.
+ */
+class PairFile {
+public:
+	explicit PairFile(std::string const &path);
+
+	inline PairFileHeader const &header() const { return header_; }
+	inline std::string const &path() const { return file_.path(); }
+
+	inline StoredPair const *begin() const { return pairs_; }
+	inline StoredPair const *end() const { return pairs_ + header_.pair_cnt; }
+
+private:
+	MappedFile file_;
+	PairFileHeader header_;
+	StoredPair const *pairs_;
+};
+
+} // namespace bitextor
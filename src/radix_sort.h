@@ -0,0 +1,58 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace bitextor {
+
+/**
+ * Sorts 64-bit keys with an LSD radix sort on bytes. `buffer` is scratch space
+ * that is resized to fit, so reusing it between calls saves the allocation.
+ * Bytes that are the same for all keys are skipped. Short arrays are left to
+ * std::sort, which is faster there than clearing the histograms.
+ */
+inline void radix_sort(std::vector<uint64_t> &keys, std::vector<uint64_t> &buffer)
+{
+	constexpr size_t kMinRadixSize = 256;
+
+	if (keys.size() < kMinRadixSize) {
+		std::sort(keys.begin(), keys.end());
+		return;
+	}
+
+	// Histograms for all bytes in a single pass over the keys
+	std::array<std::array<size_t, 256>, 8> counts{};
+	for (uint64_t key : keys)
+		for (size_t byte = 0; byte < 8; ++byte)
+			++counts[byte][(key >> (8 * byte)) & 0xFF];
+
+	buffer.resize(keys.size());
+	uint64_t *from = keys.data();
+	uint64_t *to = buffer.data();
+
+	for (size_t byte = 0; byte < 8; ++byte) {
+		std::array<size_t, 256> &count = counts[byte];
+
+		// All keys end up in the same bucket, so this pass would not change anything
+		if (count[(from[0] >> (8 * byte)) & 0xFF] == keys.size())
+			continue;
+
+		size_t offset = 0;
+		for (size_t &bucket : count) {
+			size_t size = bucket;
+			bucket = offset;
+			offset += size;
+		}
+
+		for (size_t i = 0; i < keys.size(); ++i)
+			to[count[(from[i] >> (8 * byte)) & 0xFF]++] = from[i];
+
+		std::swap(from, to);
+	}
+
+	if (from != keys.data())
+		std::copy(from, from + keys.size(), keys.data());
+}
+
+} // namespace bitextor
@@ -0,0 +1,240 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "blocking_queue.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace bitextor {
+
+/**
+ * Bounded multi-producer multi-consumer queue on a ring of slots, after
+ * Dmitry Vyukov's design: each slot has a sequence number that tells whether
+ * it is ready to be written or read, so producers and consumers only contend
+ * on an atomic counter instead of a mutex. Threads that find the queue full
+ * or empty spin for a while before they park on a condition variable.
+ * Same interface as blocking_queue.
+ */
+template <typename T> class ring_queue
+{
+public:
+	explicit ring_queue(size_t size);
+
+	void push(T const &item);
+	void push(T &&item);
+	T pop();
+
+	// Pops at least one and at most `max` items into `items`. Returns the
+	// number of items popped.
+	size_t pop(T *items, size_t max);
+
+	// Same, but returns 0 instead of waiting if the queue is empty.
+	size_t try_pop(T *items, size_t max);
+
+	queue_performance const &performance() const { return _performance; }
+private:
+	struct slot {
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	// Number of attempts before a thread parks. Spinning only helps if there
+	// is another core to make progress in the meantime.
+	size_t _spin_count;
+
+	size_t _mask;
+	std::unique_ptr<slot[]> _slots;
+
+	// Producers and consumers each on their own cache line. Padded instead of
+	// aligned, as C++11 new does not respect alignment over 16 bytes.
+	char _pad0[64];
+	std::atomic<size_t> _push_pos;
+	char _pad1[64];
+	std::atomic<size_t> _pop_pos;
+	char _pad2[64];
+
+	// Parking. Only touched by threads that gave up spinning, and by threads
+	// that see there are parked threads to wake up.
+	std::atomic<size_t> _push_waiters;
+	std::atomic<size_t> _pop_waiters;
+	std::mutex _mutex;
+	std::condition_variable _added;
+	std::condition_variable _removed;
+	queue_performance _performance;
+
+	bool try_push(T &item);
+	bool try_pop(T &item);
+	template <typename F> void wait(F attempt, std::atomic<size_t> &waiters, std::condition_variable &condition, size_t &counter, uint64_t &wait_ns);
+	void wake(std::atomic<size_t> &waiters, std::condition_variable &condition);
+};
+
+inline void spin_pause() {
+#ifdef __SSE2__
+	_mm_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
+
+template <typename T> ring_queue<T>::ring_queue(size_t size)
+:
+	_spin_count(std::thread::hardware_concurrency() > 1 ? 1024 : 0),
+	_performance{0, 0, 0, 0} {
+	size_t capacity = 1;
+	while (capacity < size)
+		capacity <<= 1;
+
+	_mask = capacity - 1;
+	_slots.reset(new slot[capacity]);
+	for (size_t i = 0; i < capacity; ++i)
+		_slots[i].sequence.store(i, std::memory_order_relaxed);
+
+	_push_pos.store(0, std::memory_order_relaxed);
+	_pop_pos.store(0, std::memory_order_relaxed);
+	_push_waiters.store(0, std::memory_order_relaxed);
+	_pop_waiters.store(0, std::memory_order_relaxed);
+}
+
+template <typename T> bool ring_queue<T>::try_push(T &item) {
+	size_t pos = _push_pos.load(std::memory_order_relaxed);
+
+	while (true) {
+		slot &cell = _slots[pos & _mask];
+		size_t sequence = cell.sequence.load(std::memory_order_acquire);
+		intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+		if (diff == 0) {
+			if (_push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				cell.value = std::move(item);
+				cell.sequence.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+		} else if (diff < 0) {
+			// Slot still holds an item from a lap ago: full
+			return false;
+		} else {
+			pos = _push_pos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+template <typename T> bool ring_queue<T>::try_pop(T &item) {
+	size_t pos = _pop_pos.load(std::memory_order_relaxed);
+
+	while (true) {
+		slot &cell = _slots[pos & _mask];
+		size_t sequence = cell.sequence.load(std::memory_order_acquire);
+		intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+
+		if (diff == 0) {
+			if (_pop_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				item = std::move(cell.value);
+				cell.sequence.store(pos + _mask + 1, std::memory_order_release);
+				return true;
+			}
+		} else if (diff < 0) {
+			// Slot not written yet: empty
+			return false;
+		} else {
+			pos = _pop_pos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+/**
+ * Calls attempt() until it succeeds: first spinning, then parked on condition.
+ * A parked thread registers itself in waiters before its last attempt, and the
+ * other side checks waiters after it changed the queue, so one of the two
+ * always sees the other. Time spent parked is added to wait_ns.
+ */
+template <typename T> template <typename F> void ring_queue<T>::wait(F attempt, std::atomic<size_t> &waiters, std::condition_variable &condition, size_t &counter, uint64_t &wait_ns) {
+	for (size_t i = 0; i < _spin_count; ++i) {
+		if (attempt())
+			return;
+		spin_pause();
+	}
+
+	std::unique_lock<std::mutex> mlock(_mutex);
+	waiters.fetch_add(1);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	if (!attempt()) {
+		auto start = std::chrono::steady_clock::now();
+		do {
+			++counter;
+			condition.wait(mlock);
+		} while (!attempt());
+		wait_ns += elapsed_ns(start);
+	}
+
+	waiters.fetch_sub(1);
+}
+
+template <typename T> void ring_queue<T>::wake(std::atomic<size_t> &waiters, std::condition_variable &condition) {
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	if (waiters.load(std::memory_order_relaxed) == 0)
+		return;
+
+	// Taking the lock makes sure the waiter is either still before its last
+	// attempt, or already waiting on the condition.
+	{
+		std::lock_guard<std::mutex> mlock(_mutex);
+	}
+	condition.notify_one();
+}
+
+template <typename T> void ring_queue<T>::push(T &&item) {
+	wait([&]() { return try_push(item); }, _push_waiters, _removed, _performance.overflow, _performance.overflow_ns);
+	wake(_pop_waiters, _added);
+}
+
+template <typename T> void ring_queue<T>::push(T const &item) {
+	T copy(item);
+	push(std::move(copy));
+}
+
+template <typename T> T ring_queue<T>::pop() {
+	T value;
+	wait([&]() { return try_pop(value); }, _pop_waiters, _added, _performance.underflow, _performance.underflow_ns);
+	wake(_push_waiters, _removed);
+	return value;
+}
+
+template <typename T> size_t ring_queue<T>::pop(T *items, size_t max) {
+	size_t count = 0;
+
+	if (max == 0)
+		return count;
+
+	wait([&]() { return try_pop(items[0]); }, _pop_waiters, _added, _performance.underflow, _performance.underflow_ns);
+
+	for (count = 1; count < max && try_pop(items[count]); ++count)
+		;
+
+	// Every popped item frees a slot that a parked producer might wait for
+	for (size_t i = 0; i < count; ++i)
+		wake(_push_waiters, _removed);
+
+	return count;
+}
+
+template <typename T> size_t ring_queue<T>::try_pop(T *items, size_t max) {
+	size_t count = 0;
+
+	while (count < max && try_pop(items[count]))
+		++count;
+
+	for (size_t i = 0; i < count; ++i)
+		wake(_push_waiters, _removed);
+
+	return count;
+}
+
+} // namespace bitextor
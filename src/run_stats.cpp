@@ -0,0 +1,231 @@
+#include "run_stats.h"
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
+#include <sys/resource.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace bitextor {
+
+double cpu_seconds() {
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+	     + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+size_t peak_rss() {
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	// Linux reports kilobytes
+	return size_t(usage.ru_maxrss) * 1024;
+}
+
+size_t current_rss() {
+	FILE *statm = fopen("/proc/self/statm", "r");
+	if (!statm)
+		return 0;
+
+	size_t size = 0, resident = 0;
+	if (fscanf(statm, "%zu %zu", &size, &resident) != 2)
+		resident = 0;
+
+	fclose(statm);
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+RunStats::RunStats()
+: start_(chrono::steady_clock::now()),
+  current_(-1),
+  cpu_start_(0),
+  documents_(0),
+  bytes_(0),
+  stopping_(false) {
+	//
+}
+
+RunStats::~RunStats() {
+	if (progress_.joinable()) {
+		{
+			lock_guard<mutex> lock(mutex_);
+			stopping_ = true;
+		}
+
+		stop_progress_.notify_all();
+		progress_.join();
+	}
+}
+
+void RunStats::begin_phase(string const &name) {
+	end_phase();
+
+	lock_guard<mutex> lock(mutex_);
+
+	for (current_ = 0; current_ < ssize_t(phases_.size()); ++current_)
+		if (phases_[current_].name == name)
+			break;
+
+	if (current_ == ssize_t(phases_.size()))
+		phases_.push_back(Phase{name, 0, 0, 0, 0, 0});
+
+	wall_start_ = chrono::steady_clock::now();
+	cpu_start_ = cpu_seconds();
+	documents_.store(0);
+	bytes_.store(0);
+}
+
+void RunStats::end_phase() {
+	lock_guard<mutex> lock(mutex_);
+
+	if (current_ < 0)
+		return;
+
+	Phase &phase = phases_[current_];
+	phase.wall_seconds += chrono::duration<double>(chrono::steady_clock::now() - wall_start_).count();
+	phase.cpu_seconds += cpu_seconds() - cpu_start_;
+	phase.documents += documents_.load();
+	phase.bytes += bytes_.load();
+	phase.peak_rss = peak_rss();
+	current_ = -1;
+}
+
+RunStats::Value &RunStats::find(string const &section, string const &name) {
+	for (Value &value : values_)
+		if (value.section == section && value.name == name)
+			return value;
+
+	values_.push_back(Value{section, name, "", {0}, false});
+	return values_.back();
+}
+
+void RunStats::set(string const &section, string const &name, size_t value) {
+	find(section, name).counts = {value};
+}
+
+void RunStats::set(string const &section, string const &name, double value) {
+	ostringstream json;
+	json << fixed << setprecision(6) << value;
+	find(section, name).json = json.str();
+}
+
+void RunStats::add(string const &section, string const &name, size_t value) {
+	find(section, name).counts[0] += value;
+}
+
+void RunStats::add(string const &section, string const &name, vector<size_t> const &values) {
+	Value &entry = find(section, name);
+
+	if (!entry.list) {
+		entry.counts.clear();
+		entry.list = true;
+	}
+
+	if (entry.counts.size() < values.size())
+		entry.counts.resize(values.size(), 0);
+
+	for (size_t i = 0; i < values.size(); ++i)
+		entry.counts[i] += values[i];
+}
+
+void RunStats::add(string const &name, queue_performance const &performance) {
+	add("queues", name + "_overflow", performance.overflow);
+	add("queues", name + "_overflow_ns", performance.overflow_ns);
+	add("queues", name + "_underflow", performance.underflow);
+	add("queues", name + "_underflow_ns", performance.underflow_ns);
+}
+
+void RunStats::start_progress(double interval, ostream &out) {
+	progress_ = thread(&RunStats::report_progress, this, interval, ref(out));
+}
+
+void RunStats::report_progress(double interval, ostream &out) {
+	unique_lock<mutex> lock(mutex_);
+
+	while (!stop_progress_.wait_for(lock, chrono::duration<double>(interval), [this]() { return stopping_; })) {
+		if (current_ < 0)
+			continue;
+
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - wall_start_).count();
+		size_t documents = documents_.load(), bytes = bytes_.load();
+
+		// Formatted separately, to not change the flags of out
+		ostringstream line;
+		line << phases_[current_].name << ": " << documents << " documents"
+		     << " (" << size_t(documents / seconds) << "/s), "
+		     << bytes / (1024 * 1024) << " MB (" << size_t(bytes / seconds / (1024 * 1024)) << " MB/s)"
+		     << " in " << fixed << setprecision(1) << seconds << "s,"
+		     << " RSS " << current_rss() / (1024 * 1024) << " MB\n";
+		out << line.str() << flush;
+	}
+}
+
+void RunStats::write_json(ostream &out) {
+	end_phase();
+
+	lock_guard<mutex> lock(mutex_);
+
+	out << fixed << setprecision(6)
+	    << "{\n"
+	    << "  \"wall_seconds\": " << chrono::duration<double>(chrono::steady_clock::now() - start_).count() << ",\n"
+	    << "  \"cpu_seconds\": " << cpu_seconds() << ",\n"
+	    << "  \"peak_rss\": " << peak_rss() << ",\n"
+	    << "  \"phases\": [";
+
+	for (size_t i = 0; i < phases_.size(); ++i) {
+		Phase const &phase = phases_[i];
+		double seconds = max(phase.wall_seconds, 1e-9);
+
+		out << (i > 0 ? "," : "") << "\n"
+		    << "    {\"name\": \"" << phase.name << "\""
+		    << ", \"wall_seconds\": " << phase.wall_seconds
+		    << ", \"cpu_seconds\": " << phase.cpu_seconds
+		    << ", \"documents\": " << phase.documents
+		    << ", \"bytes\": " << phase.bytes
+		    << ", \"documents_per_second\": " << phase.documents / seconds
+		    << ", \"bytes_per_second\": " << phase.bytes / seconds
+		    << ", \"peak_rss\": " << phase.peak_rss
+		    << "}";
+	}
+
+	out << "\n  ]";
+
+	// Values by section, in the order the sections first got a value
+	vector<string> sections;
+	for (Value const &value : values_)
+		if (find_if(sections.begin(), sections.end(), [&](string const &section) { return section == value.section; }) == sections.end())
+			sections.push_back(value.section);
+
+	for (string const &section : sections) {
+		out << ",\n  \"" << section << "\": {";
+
+		bool first = true;
+		for (Value const &value : values_) {
+			if (value.section != section)
+				continue;
+
+			out << (first ? "" : ",") << "\n    \"" << value.name << "\": ";
+			first = false;
+
+			if (!value.json.empty()) {
+				out << value.json;
+			} else if (!value.list) {
+				out << value.counts[0];
+			} else {
+				out << "[";
+				for (size_t i = 0; i < value.counts.size(); ++i)
+					out << (i > 0 ? ", " : "") << value.counts[i];
+				out << "]";
+			}
+		}
+
+		out << "\n  }";
+	}
+
+	out << "\n}" << endl;
+}
+
+} // namespace bitextor
@@ -0,0 +1,112 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+#include "blocking_queue.h"
+
+namespace bitextor {
+
+/**
+ * Statistics of a run, split into phases. Each phase gets its wall clock and
+ * CPU time, the documents and bytes read during it, and the peak memory use
+ * of the process at its end. Running a phase again adds to it. Other figures
+ * are kept by section and name in the order they were first set, and should
+ * only be set from one thread. All of it is written out as JSON at the end.
+ *
+ * Optionally reports the progress of the current phase every so often from a
+ * background thread.
+ */
+class RunStats {
+public:
+	RunStats();
+
+	~RunStats();
+
+	// Ends the current phase, if any, and starts timing `name`
+	void begin_phase(std::string const &name);
+
+	void end_phase();
+
+	// Counts input read during the current phase. Safe to call from any thread.
+	inline void add_input(size_t documents, size_t bytes) {
+		documents_.fetch_add(documents, std::memory_order_relaxed);
+		bytes_.fetch_add(bytes, std::memory_order_relaxed);
+	}
+
+	void set(std::string const &section, std::string const &name, size_t value);
+
+	void set(std::string const &section, std::string const &name, double value);
+
+	// Adds to a count instead of replacing it
+	void add(std::string const &section, std::string const &name, size_t value);
+
+	// Adds to a list of counts element by element, such as a histogram
+	void add(std::string const &section, std::string const &name, std::vector<size_t> const &values);
+
+	// Adds the waits of a queue to section "queues" under `name`
+	void add(std::string const &name, queue_performance const &performance);
+
+	// Writes a line about the current phase to `out` every `interval` seconds
+	void start_progress(double interval, std::ostream &out);
+
+	void write_json(std::ostream &out);
+
+private:
+	struct Phase {
+		std::string name;
+		double wall_seconds;
+		double cpu_seconds;
+		size_t documents;
+		size_t bytes;
+		size_t peak_rss;
+	};
+
+	struct Value {
+		std::string section;
+		std::string name;
+
+		// Either a number formatted as JSON, or a count or list of counts
+		std::string json;
+		std::vector<size_t> counts;
+		bool list;
+	};
+
+	std::chrono::steady_clock::time_point start_;
+
+	// Guards the phases and the current phase against the progress thread
+	std::mutex mutex_;
+	std::vector<Phase> phases_;
+	std::vector<Value> values_;
+
+	// Current phase: index in phases_, or -1 if there is none
+	ssize_t current_;
+	std::chrono::steady_clock::time_point wall_start_;
+	double cpu_start_;
+	std::atomic<size_t> documents_;
+	std::atomic<size_t> bytes_;
+
+	std::thread progress_;
+	std::condition_variable stop_progress_;
+	bool stopping_;
+
+	Value &find(std::string const &section, std::string const &name);
+	void report_progress(double interval, std::ostream &out);
+};
+
+// CPU time (user and system) of the process so far in seconds
+double cpu_seconds();
+
+// Largest resident set size of the process so far, in bytes
+size_t peak_rss();
+
+// Current resident set size of the process in bytes, or 0 if unknown
+size_t current_rss();
+
+} // namespace bitextor
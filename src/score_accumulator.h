@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace bitextor {
+
+/**
+ * Dense array of scores for one document against a block of reference
+ * documents. Keeps a list of the entries that were touched so resetting it
+ * costs as much as the number of candidates, not as the size of the block.
+ */
+class ScoreAccumulator {
+public:
+	explicit ScoreAccumulator(size_t size)
+	: scores_(size, 0),
+	  seen_(size, 0) {
+		//
+	}
+
+	inline size_t size() const {
+		return scores_.size();
+	}
+
+	inline void add(uint32_t index, float score) {
+		if (!seen_[index]) {
+			seen_[index] = 1;
+			touched_.push_back(index);
+		}
+
+		scores_[index] += score;
+	}
+
+	// Marks index as touched without changing its score
+	inline void touch(uint32_t index) {
+		if (!seen_[index]) {
+			seen_[index] = 1;
+			touched_.push_back(index);
+		}
+	}
+
+	// Indices touched so far, in the order they were first touched
+	inline std::vector<uint32_t> const &touched() const {
+		return touched_;
+	}
+
+	// Calls fun(index, score) for every touched entry and resets them.
+	template <typename F> void drain(F fun) {
+		for (uint32_t index : touched_) {
+			fun(index, scores_[index]);
+			scores_[index] = 0;
+			seen_[index] = 0;
+		}
+
+		touched_.clear();
+	}
+
+private:
+	std::vector<float> scores_;
+	std::vector<uint8_t> seen_;
+	std::vector<uint32_t> touched_;
+};
+
+} // namespace bitextor
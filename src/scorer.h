@@ -0,0 +1,268 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <utility>
+#include <vector>
+#include "document.h"
+#include "ngram_index.h"
+#include "score_accumulator.h"
+
+namespace bitextor {
+
+/**
+ * Scores documents against all reference documents in an index. Holds the
+ * scratch space for that, so use one per thread.
+ *
+ * Only scores that reach the threshold are needed, which allows MaxScore
+ * style pruning: the ngrams of the document with the least impact, that
+ * together cannot add up to the threshold, cannot make a reference document
+ * reach it on their own. The reference documents the other ngrams occur in
+ * are the candidates, and long posting lists of the former are skipped
+ * through by looking those up. Scores are still added up in the same order
+ * as without pruning, so they come out exactly the same.
+ */
+class Scorer {
+public:
+	// Maximum number of reference documents to accumulate scores for at the
+	// same time. Documents are scored block by block if there are more.
+	static constexpr size_t kMaxBlockSize = 1 << 22;
+
+	// Look up candidates in a posting list instead of walking through it when
+	// the list is this many times longer than the list of candidates.
+	static constexpr size_t kSeekRatio = 8;
+
+	// Pruning only pays off by skipping through long posting lists, so
+	// documents without a list at least this long are scored without it.
+	static constexpr size_t kMinPruneListSize = 1024;
+
+	Scorer(NGramIndex const &ref_index, size_t ref_document_cnt, float threshold)
+	: ref_index_(ref_index),
+	  ref_document_cnt_(ref_document_cnt),
+	  threshold_(threshold),
+	  ref_scores_(std::min(ref_document_cnt, size_t(kMaxBlockSize))),
+	  candidate_cnt_(0) {
+		//
+	}
+
+	// Calls fun(ref_id, score) for every reference document that shares at
+	// least one ngram with document and might score at least the threshold.
+	// Reference ids start counting at 1.
+	template <typename F> void score(DocumentRef const &document, F fun) {
+		if (ref_index_.packed())
+			score_blocks(document, packed_terms_, fun);
+		else
+			score_blocks(document, terms_, fun);
+	}
+
+private:
+	template <typename List> struct Term {
+		// Tfidf of the ngram in the document
+		float tfidf;
+
+		// Position of the ngram in the index
+		uint32_t key;
+
+		// Whether it can put reference documents on the list of candidates
+		bool essential;
+
+		// Remaining postings of the ngram
+		List postings;
+	};
+
+	NGramIndex const &ref_index_;
+	size_t ref_document_cnt_;
+	float threshold_;
+	ScoreAccumulator ref_scores_;
+
+	// Ngrams of the document that occur in the index. Only one of the two is
+	// used, depending on whether the index is packed.
+	std::vector<Term<NGramIndex::PostingList>> terms_;
+	std::vector<Term<PackedPostingList>> packed_terms_;
+
+	// Scratch space for picking the essential terms, and for the candidates
+	// of a block: the reference documents the essential terms occur in. The
+	// first candidate_cnt_ touched entries of ref_scores_ are those, and
+	// candidates_ holds them in order of doc id once a posting list is long
+	// enough to look them up in.
+	std::vector<std::pair<float, size_t>> order_;
+	std::vector<uint32_t> candidates_;
+	size_t candidate_cnt_;
+
+	inline NGramIndex::PostingList find(uint32_t key, NGramIndex::PostingList *) const {
+		return ref_index_.postings(key);
+	}
+
+	inline PackedPostingList find(uint32_t key, PackedPostingList *) const {
+		return ref_index_.packed_postings(key);
+	}
+
+	// Calls fun(doc_id, tfidf) for the postings below block_end, and drops
+	// them from the list.
+	template <typename F> static inline void read_until(NGramIndex::PostingList &postings, size_t block_end, F fun) {
+		NGramIndex::Posting const *it = postings.begin();
+		for (; it != postings.end() && it->doc_id < block_end; ++it)
+			fun(it->doc_id, it->tfidf);
+		postings = NGramIndex::PostingList(it, postings.end());
+	}
+
+	template <typename F> static inline void read_until(PackedPostingList &postings, size_t block_end, F fun) {
+		postings.read_until(block_end, fun);
+	}
+
+	// Adds all postings below block_end to the scores, and drops them from
+	// the list.
+	template <typename List> inline void add_all(List &postings, float tfidf, size_t block_begin, size_t block_end) {
+		read_until(postings, block_end, [&](uint32_t doc_id, float ref_tfidf) {
+			ref_scores_.add(doc_id - block_begin, tfidf * ref_tfidf);
+		});
+	}
+
+	// Adds the postings below block_end of a term that is not essential, and
+	// drops them from the list. Long lists are skipped through by looking up
+	// the candidates in them. Short ones are read like any other: what that
+	// adds to reference documents that are not candidates is less than the
+	// threshold, since it only comes from terms that are not essential.
+	inline void add_to_candidates(NGramIndex::PostingList &postings, float tfidf, size_t block_begin, size_t block_end) {
+		if (candidate_cnt_ * kSeekRatio >= postings.size()) {
+			add_all(postings, tfidf, block_begin, block_end);
+			return;
+		}
+
+		if (candidates_.size() != candidate_cnt_) {
+			candidates_.assign(ref_scores_.touched().begin(), ref_scores_.touched().begin() + candidate_cnt_);
+			std::sort(candidates_.begin(), candidates_.end());
+		}
+
+		auto by_doc_id = [](NGramIndex::Posting const &posting, size_t doc_id) {
+			return posting.doc_id < doc_id;
+		};
+
+		NGramIndex::Posting const *it = postings.begin();
+		for (uint32_t index : candidates_) {
+			it = std::lower_bound(it, postings.end(), block_begin + index, by_doc_id);
+			if (it == postings.end())
+				break;
+			if (it->doc_id == block_begin + index)
+				ref_scores_.add(index, tfidf * it->tfidf);
+		}
+
+		postings = NGramIndex::PostingList(std::lower_bound(it, postings.end(), block_end, by_doc_id), postings.end());
+	}
+
+	inline void add_to_candidates(PackedPostingList &postings, float tfidf, size_t block_begin, size_t block_end) {
+		add_all(postings, tfidf, block_begin, block_end);
+	}
+
+	/**
+	 * Marks the terms with the highest bounds as essential, leaving out as
+	 * many of the others as possible while their bounds add up to less than
+	 * the threshold. The sum gets some slack for the rounding errors in adding
+	 * up the actual scores. Returns whether that is worth it: finding the
+	 * candidates costs a pass over the postings of the essential terms, which
+	 * only pays off if most postings are in lists that are skipped through.
+	 */
+	template <typename List> bool pick_essential(std::vector<Term<List>> &terms, size_t posting_cnt) {
+		// Most each term can add to the score of any reference document
+		order_.clear();
+		for (size_t i = 0; i < terms.size(); ++i)
+			order_.emplace_back(std::abs(terms[i].tfidf) * ref_index_.bound(terms[i].key), i);
+
+		std::sort(order_.begin(), order_.end());
+
+		double slack = 1 + 2 * terms.size() * double(FLT_EPSILON);
+		double sum = 0;
+		size_t skipped_cnt = 0;
+		size_t skipped_postings = 0;
+
+		for (auto const &entry : order_) {
+			sum += entry.first;
+			if (sum * slack >= threshold_)
+				break;
+
+			++skipped_cnt;
+			skipped_postings += terms[entry.second].postings.size();
+		}
+
+		// There are at most as many candidates as essential postings
+		size_t max_candidate_cnt = posting_cnt - skipped_postings;
+		size_t seek_postings = 0;
+
+		for (size_t i = 0; i < skipped_cnt; ++i) {
+			size_t size = terms[order_[i].second].postings.size();
+			if (size > max_candidate_cnt * kSeekRatio)
+				seek_postings += size;
+		}
+
+		if (seek_postings * 2 < posting_cnt)
+			return false;
+
+		for (size_t i = 0; i < skipped_cnt; ++i)
+			terms[order_[i].second].essential = false;
+
+		return true;
+	}
+
+	template <typename List, typename F> void score_blocks(DocumentRef const &document, std::vector<Term<List>> &terms, F fun) {
+		terms.clear();
+		size_t posting_cnt = 0;
+		size_t max_list_size = 0;
+
+		for (auto const &word_score : document.wordvec) {
+			// Search ngram hash (uint64_t) in ref_index
+			uint32_t key = ref_index_.lookup(word_score.hash);
+			if (key == NGramIndex::kEmptySlot)
+				continue;
+
+			List ref_postings(find(key, static_cast<List *>(nullptr)));
+			if (!ref_postings.empty()) {
+				terms.push_back(Term<List>{word_score.tfidf, key, true, ref_postings});
+				posting_cnt += ref_postings.size();
+				max_list_size = std::max(max_list_size, ref_postings.size());
+			}
+		}
+
+		// Packed postings can only be read front to back, so there is nothing
+		// to gain from pruning them.
+		bool pruned = threshold_ > 0
+			&& !ref_index_.packed()
+			&& max_list_size >= kMinPruneListSize
+			&& pick_essential(terms, posting_cnt);
+
+		// Postings are sorted by doc id, so each block continues where the
+		// previous one stopped.
+		for (size_t block_begin = 1; block_begin <= ref_document_cnt_; block_begin += ref_scores_.size()) {
+			size_t block_end = block_begin + ref_scores_.size();
+
+			// Find the candidates first, so that all scores can be added up in
+			// the order of the terms.
+			if (pruned) {
+				for (auto const &term : terms) {
+					if (!term.essential)
+						continue;
+
+					List postings(term.postings);
+					read_until(postings, block_end, [&](uint32_t doc_id, float) {
+						ref_scores_.touch(doc_id - block_begin);
+					});
+				}
+
+				candidate_cnt_ = ref_scores_.touched().size();
+				candidates_.clear();
+			}
+
+			for (auto &term : terms) {
+				if (term.essential)
+					add_all(term.postings, term.tfidf, block_begin, block_end);
+				else
+					add_to_candidates(term.postings, term.tfidf, block_begin, block_end);
+			}
+
+			ref_scores_.drain([&](uint32_t index, float score) {
+				fun(block_begin + index, score);
+			});
+		}
+	}
+};
+
+} // namespace bitextor
@@ -0,0 +1,236 @@
+#include "serve_protocol.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "util/exception.hh"
+#include "util/file.hh"
+
+using namespace std;
+
+namespace bitextor {
+
+namespace {
+
+constexpr size_t kBufferSize = 1 << 16;
+
+// Parses a count of at most max. Returns false if line is not one.
+bool parse_count(string const &line, size_t max, size_t &count) {
+	if (line.empty() || line.size() > 20)
+		return false;
+
+	count = 0;
+	for (char c : line) {
+		if (c < '0' || c > '9')
+			return false;
+		count = count * 10 + (c - '0');
+	}
+
+	return count <= max;
+}
+
+// Start of line, for in an error message
+string quote(string const &line) {
+	return "\"" + (line.size() > 40 ? line.substr(0, 40) + "..." : line) + "\"";
+}
+
+sockaddr_un unix_address(string const &path) {
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	UTIL_THROW_IF(path.size() >= sizeof(address.sun_path), util::Exception, "Socket path " << path << " is too long");
+	memcpy(address.sun_path, path.data(), path.size());
+	return address;
+}
+
+} // namespace
+
+LineConnection::LineConnection(int in, int out)
+: in_(in),
+  out_(out),
+  buffer_(kBufferSize),
+  begin_(0),
+  end_(0) {
+	//
+}
+
+bool LineConnection::read_line(string &line) {
+	line.clear();
+
+	while (true) {
+		const char *begin = buffer_.data() + begin_, *end = buffer_.data() + end_;
+		const char *newline = static_cast<const char *>(memchr(begin, '\n', end - begin));
+
+		if (newline) {
+			line.append(begin, newline);
+			begin_ = newline + 1 - buffer_.data();
+			break;
+		}
+
+		line.append(begin, end);
+		begin_ = end_ = 0;
+
+		ssize_t size;
+		do {
+			size = read(in_, buffer_.data(), buffer_.size());
+		} while (size == -1 && errno == EINTR);
+
+		// The last line might not have a newline
+		if (size <= 0) {
+			if (line.empty())
+				return false;
+			break;
+		}
+
+		end_ = size;
+	}
+
+	if (!line.empty() && line.back() == '\r')
+		line.pop_back();
+
+	return true;
+}
+
+bool LineConnection::write(string const &data) {
+	for (size_t done = 0; done < data.size();) {
+		ssize_t size = ::write(out_, data.data() + done, data.size() - done);
+		if (size == -1 && errno == EINTR)
+			continue;
+		if (size <= 0)
+			return false;
+		done += size;
+	}
+
+	return true;
+}
+
+bool read_request(LineConnection &connection, vector<string> &documents, string &error) {
+	documents.clear();
+	error.clear();
+
+	string line;
+	if (!connection.read_line(line))
+		return false;
+
+	size_t count;
+	if (!parse_count(line, kMaxRequestDocuments, count)) {
+		error = "expected the number of documents, up to " + to_string(kMaxRequestDocuments) + ", but got " + quote(line);
+		return false;
+	}
+
+	// The count might be made up, so only allocate for what arrives
+	documents.reserve(min(count, size_t(1024)));
+
+	for (size_t i = 0; i < count; ++i) {
+		documents.emplace_back();
+		if (!connection.read_line(documents.back())) {
+			error = "request ended after " + to_string(i) + " of " + to_string(count) + " documents";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool write_request(LineConnection &connection, vector<string> const &documents) {
+	string request(to_string(documents.size()) + "\n");
+
+	for (string const &document : documents) {
+		request += document;
+		request += '\n';
+	}
+
+	return connection.write(request);
+}
+
+bool read_response(LineConnection &connection, vector<string> &lines, string &error) {
+	lines.clear();
+	error.clear();
+
+	string line;
+	if (!connection.read_line(line)) {
+		error = "connection closed without a response";
+		return false;
+	}
+
+	if (line.compare(0, 6, "error\t") == 0) {
+		error = line.substr(6);
+		return false;
+	}
+
+	size_t count;
+	if (!parse_count(line, SIZE_MAX / 10, count)) {
+		error = "expected the number of pairs, but got " + quote(line);
+		return false;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		lines.emplace_back();
+		if (!connection.read_line(lines.back())) {
+			error = "response ended after " + to_string(i) + " of " + to_string(count) + " pairs";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+string format_pair(DocumentPair const &pair) {
+	char line[64];
+	snprintf(line, sizeof(line), "%.5f\t%zu\t%zu\n", pair.score, pair.in_idx, pair.en_idx);
+	return line;
+}
+
+bool write_response(LineConnection &connection, vector<DocumentPair> const &pairs) {
+	string response(to_string(pairs.size()) + "\n");
+
+	for (DocumentPair const &pair : pairs)
+		response += format_pair(pair);
+
+	return connection.write(response);
+}
+
+bool write_error(LineConnection &connection, string const &error) {
+	return connection.write("error\t" + error + "\n");
+}
+
+int listen_unix(string const &path) {
+	sockaddr_un address(unix_address(path));
+
+	// A socket left behind by a server that is gone can be replaced, but not
+	// one that is still in use.
+	struct stat info;
+	if (lstat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+		util::scoped_fd probe(socket(AF_UNIX, SOCK_STREAM, 0));
+		UTIL_THROW_IF(probe.get() != -1 && connect(probe.get(), reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0,
+			util::Exception, "Another server is listening on " << path);
+		unlink(path.c_str());
+	}
+
+	util::scoped_fd fd(socket(AF_UNIX, SOCK_STREAM, 0));
+	UTIL_THROW_IF(fd.get() == -1, util::ErrnoException, "Could not create socket");
+	UTIL_THROW_IF(bind(fd.get(), reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1,
+		util::ErrnoException, "Could not bind socket to " << path);
+	UTIL_THROW_IF(listen(fd.get(), SOMAXCONN) == -1, util::ErrnoException, "Could not listen on " << path);
+
+	return fd.release();
+}
+
+int connect_unix(string const &path) {
+	sockaddr_un address(unix_address(path));
+
+	util::scoped_fd fd(socket(AF_UNIX, SOCK_STREAM, 0));
+	UTIL_THROW_IF(fd.get() == -1, util::ErrnoException, "Could not create socket");
+	UTIL_THROW_IF(connect(fd.get(), reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1,
+		util::ErrnoException, "Could not connect to " << path);
+
+	return fd.release();
+}
+
+} // namespace bitextor
@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "document_pair.h"
+
+namespace bitextor {
+
+/**
+ * Requests and responses of `docalign --serve`, as lines of text. A request
+ * is a line with the number of documents in it, followed by one base64
+ * encoded document per line. The response is a line with the number of
+ * pairs, followed by a line per pair with its score and the indices of its
+ * translated and English documents, separated by tabs like docalign prints
+ * them. English documents are numbered from 1 within the request. A request
+ * that can't be read gets a single line of "error", a tab and what was wrong
+ * with it, after which the connection is closed.
+ */
+
+// Most documents in a single request
+constexpr size_t kMaxRequestDocuments = 1 << 24;
+
+/**
+ * Buffered reading of lines from a file descriptor, and writing to another.
+ * Does not close either.
+ */
+class LineConnection {
+public:
+	LineConnection(int in, int out);
+
+	// Reads the next line without its newline or carriage return. Returns
+	// false at the end of the input, or if reading failed.
+	bool read_line(std::string &line);
+
+	// Writes all of data. Returns false if the other side went away.
+	bool write(std::string const &data);
+
+private:
+	int in_;
+	int out_;
+	std::vector<char> buffer_;
+	size_t begin_;
+	size_t end_;
+};
+
+// Reads a request into documents. Returns false at the end of the input, in
+// which case error says what was wrong with the request if it was cut off
+// or malformed.
+bool read_request(LineConnection &connection, std::vector<std::string> &documents, std::string &error);
+
+bool write_request(LineConnection &connection, std::vector<std::string> const &documents);
+
+// Reads a response into lines, each a pair formatted like docalign prints it.
+// Returns false if there was none, with the error the server sent, if any.
+bool read_response(LineConnection &connection, std::vector<std::string> &lines, std::string &error);
+
+bool write_response(LineConnection &connection, std::vector<DocumentPair> const &pairs);
+
+bool write_error(LineConnection &connection, std::string const &error);
+
+// Formats a pair like print_score, including the newline
+std::string format_pair(DocumentPair const &pair);
+
+// Listening socket at path, replacing a socket that was left behind there.
+// Throws if it can't be created.
+int listen_unix(std::string const &path);
+
+// Socket connected to a server listening at path. Throws if it can't.
+int connect_unix(std::string const &path);
+
+} // namespace bitextor
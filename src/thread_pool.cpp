@@ -0,0 +1,191 @@
+#include "thread_pool.h"
+
+using namespace std;
+
+namespace bitextor {
+
+namespace {
+
+// Pool and index of the worker the current thread is, if any
+thread_local ThreadPool *current_pool = nullptr;
+thread_local size_t current_worker = 0;
+
+} // namespace
+
+ThreadPool::ThreadPool(size_t threads, size_t queue_size)
+: queue_(queue_size),
+  queued_(0),
+  pending_(0),
+  sleeping_(0),
+  stop_(false) {
+	threads = max(threads, size_t(1));
+
+	workers_.reserve(threads);
+	for (size_t i = 0; i < threads; ++i)
+		workers_.emplace_back(new Worker());
+
+	threads_.reserve(threads);
+	for (size_t i = 0; i < threads; ++i)
+		threads_.emplace_back(&ThreadPool::run, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		lock_guard<mutex> lock(idle_mutex_);
+		stop_ = true;
+	}
+
+	idle_.notify_all();
+
+	for (thread &worker : threads_)
+		worker.join();
+}
+
+void ThreadPool::submit(Task &&task) {
+	pending_.fetch_add(1);
+	queued_.fetch_add(1);
+
+	if (current_pool == this) {
+		Worker &self = *workers_[current_worker];
+		lock_guard<mutex> lock(self.mutex);
+		self.tasks.push_back(std::move(task));
+	} else {
+		queue_.push(std::move(task));
+	}
+
+	wake();
+}
+
+void ThreadPool::wait() {
+	{
+		unique_lock<mutex> lock(done_mutex_);
+		done_.wait(lock, [this]() { return pending_.load() == 0; });
+	}
+
+	lock_guard<mutex> lock(error_mutex_);
+	if (error_) {
+		exception_ptr error(error_);
+		error_ = nullptr;
+		rethrow_exception(error);
+	}
+}
+
+bool ThreadPool::find_task(size_t id, Task &task) {
+	if (!take_task(id, task))
+		return false;
+
+	queued_.fetch_sub(1);
+	return true;
+}
+
+/**
+ * Finds work for worker `id`: the newest task on its own deque, otherwise a
+ * few tasks from the shared queue, otherwise the oldest task of another
+ * worker.
+ */
+bool ThreadPool::take_task(size_t id, Task &task) {
+	Worker &self = *workers_[id];
+
+	{
+		lock_guard<mutex> lock(self.mutex);
+		if (!self.tasks.empty()) {
+			task = std::move(self.tasks.back());
+			self.tasks.pop_back();
+			return true;
+		}
+	}
+
+	Task grabbed[kGrabSize];
+	size_t grabbed_cnt = queue_.try_pop(grabbed, kGrabSize);
+
+	if (grabbed_cnt > 0) {
+		task = std::move(grabbed[0]);
+
+		if (grabbed_cnt > 1) {
+			{
+				// Reversed, so they run in order when popped from the back
+				lock_guard<mutex> lock(self.mutex);
+				for (size_t i = grabbed_cnt - 1; i > 0; --i)
+					self.tasks.push_back(std::move(grabbed[i]));
+			}
+
+			// Others may steal those
+			wake();
+		}
+
+		return true;
+	}
+
+	for (size_t i = 1; i < workers_.size(); ++i) {
+		Worker &victim = *workers_[(id + i) % workers_.size()];
+		lock_guard<mutex> lock(victim.mutex);
+		if (!victim.tasks.empty()) {
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::run(size_t id) {
+	current_pool = this;
+	current_worker = id;
+
+	while (true) {
+		Task task;
+
+		if (!find_task(id, task)) {
+			// Same handshake as ring_queue: register as sleeping before the
+			// last look for work, so whoever adds work after that sees us.
+			unique_lock<mutex> lock(idle_mutex_);
+			sleeping_.fetch_add(1);
+			atomic_thread_fence(memory_order_seq_cst);
+
+			auto start = chrono::steady_clock::now();
+
+			while (!stop_ && queued_.load() == 0)
+				idle_.wait(lock);
+
+			idle_ns_.fetch_add(elapsed_ns(start));
+
+			sleeping_.fetch_sub(1);
+
+			if (stop_)
+				break;
+
+			continue;
+		}
+
+		try {
+			task(id);
+		} catch (...) {
+			lock_guard<mutex> lock(error_mutex_);
+			if (!error_)
+				error_ = current_exception();
+		}
+
+		// Release whatever the task holds on to before reporting it done
+		task = nullptr;
+
+		if (pending_.fetch_sub(1) == 1) {
+			lock_guard<mutex> lock(done_mutex_);
+			done_.notify_all();
+		}
+	}
+}
+
+void ThreadPool::wake() {
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (sleeping_.load(memory_order_relaxed) == 0)
+		return;
+
+	{
+		lock_guard<mutex> lock(idle_mutex_);
+	}
+	idle_.notify_one();
+}
+
+} // namespace bitextor
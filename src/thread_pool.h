@@ -0,0 +1,93 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ring_queue.h"
+
+namespace bitextor {
+
+/**
+ * Fixed set of worker threads that run tasks, shared by all phases of
+ * docalign so that -j means the same thing everywhere. Tasks submitted from
+ * outside the pool go through a bounded lock-free queue, which blocks the
+ * submitter when the workers fall behind. Workers take a few tasks at a time
+ * from that queue into their own deque. Tasks submitted by a task go onto the
+ * deque of the worker that runs it. A worker without work steals from the
+ * other deques before it goes to sleep.
+ *
+ * Tasks get the index of the worker that runs them, which is handy to keep
+ * per-worker state in a vector of size().
+ */
+class ThreadPool {
+public:
+	typedef std::function<void(size_t)> Task;
+
+	// queue_size is the number of submitted tasks that can be waiting
+	ThreadPool(size_t threads, size_t queue_size);
+
+	~ThreadPool();
+
+	inline size_t size() const { return workers_.size(); }
+
+	void submit(Task &&task);
+
+	// Waits until all submitted tasks have finished. Rethrows the first
+	// exception a task threw, if any.
+	void wait();
+
+	// How often and how long submitters outside the pool waited for room in
+	// the shared queue (overflow)
+	inline queue_performance const &submit_performance() const {
+		return queue_.performance();
+	}
+
+	// Total time workers spent asleep for lack of tasks
+	inline uint64_t idle_ns() const {
+		return idle_ns_.load();
+	}
+
+private:
+	struct Worker {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	// Number of tasks a worker takes from the shared queue at once
+	static constexpr size_t kGrabSize = 4;
+
+	ring_queue<Task> queue_;
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::vector<std::thread> threads_;
+
+	// Tasks submitted but not started yet
+	std::atomic<size_t> queued_;
+
+	// Tasks submitted but not finished yet
+	std::atomic<size_t> pending_;
+	std::mutex done_mutex_;
+	std::condition_variable done_;
+
+	// Sleeping workers, and how long they slept in total
+	std::atomic<size_t> sleeping_;
+	std::atomic<uint64_t> idle_ns_;
+	std::mutex idle_mutex_;
+	std::condition_variable idle_;
+	bool stop_;
+
+	std::mutex error_mutex_;
+	std::exception_ptr error_;
+
+	void run(size_t id);
+	bool find_task(size_t id, Task &task);
+	bool take_task(size_t id, Task &task);
+	void wake();
+};
+
+} // namespace bitextor
@@ -0,0 +1,71 @@
+#define BOOST_TEST_MODULE approx_df
+#include <map>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include "../src/approx_df.h"
+
+using namespace bitextor;
+using namespace std;
+
+namespace {
+
+// Ngram i occurs i % 50 + 1 times, with ngram 0 occurring far more often
+vector<uint64_t> make_stream() {
+	vector<uint64_t> stream;
+	for (uint64_t i = 0; i < 5000; ++i)
+		for (uint64_t j = 0; j <= i % 50; ++j)
+			stream.push_back((i + 1) * 0x9E3779B97F4A7C15ull);
+
+	stream.insert(stream.end(), 20000, 0x9E3779B97F4A7C15ull);
+	return stream;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(test_count_min)
+{
+	vector<uint64_t> stream(make_stream());
+
+	map<uint64_t, uint64_t> exact;
+	for (uint64_t hash : stream)
+		++exact[hash];
+
+	// Split over two sketches that are merged, like the workers of docalign
+	CountMinSketch sketch(1 << 12), other(1 << 12);
+	for (size_t i = 0; i < stream.size(); ++i)
+		(i % 2 ? sketch : other).add(NGram{stream[i]});
+
+	sketch.merge(other);
+	BOOST_TEST(sketch.total() == stream.size());
+
+	size_t within_bound = 0;
+	for (auto const &entry : exact) {
+		uint64_t estimate = count_min_df(sketch.counters().data(), 1, sketch.shift(), entry.first, 1, 1);
+
+		// Never too low
+		BOOST_TEST(estimate >= entry.second);
+		within_bound += estimate <= entry.second + sketch.error_bound();
+	}
+
+	BOOST_TEST(within_bound >= exact.size() * sketch.confidence());
+
+	// Counts below the minimum are left out
+	BOOST_TEST(count_min_df(sketch.counters().data(), 1, sketch.shift(), 2 * 0x9E3779B97F4A7C15ull, 1, 1000) == 0);
+	BOOST_TEST(count_min_df(sketch.counters().data(), 1, sketch.shift(), 0x9E3779B97F4A7C15ull, 2, 1) >= 2 * 20001);
+}
+
+BOOST_AUTO_TEST_CASE(test_heavy_hitters)
+{
+	vector<uint64_t> stream(make_stream());
+	HeavyHitters hitters(16);
+	for (uint64_t hash : stream)
+		hitters.add(NGram{hash});
+
+	// Ngram 1 makes up more than a sixth of the stream
+	bool found = false;
+	hitters.each([&found](NGram const &ngram) {
+		found |= ngram.hash == 0x9E3779B97F4A7C15ull;
+	});
+
+	BOOST_TEST(found);
+}
@@ -0,0 +1,96 @@
+#define BOOST_TEST_MODULE base64
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <util/exception.hh>
+#include "../src/base64.h"
+
+using namespace bitextor;
+using namespace std;
+
+string encode(string const &in)
+{
+	string out;
+	base64_encode(in, out);
+	return out;
+}
+
+string decode(string const &in)
+{
+	string out;
+	base64_decode(in, out);
+	return out;
+}
+
+BOOST_AUTO_TEST_CASE(test_rfc4648)
+{
+	vector<pair<string,string>> vectors{
+		{"", ""},
+		{"f", "Zg=="},
+		{"fo", "Zm8="},
+		{"foo", "Zm9v"},
+		{"foob", "Zm9vYg=="},
+		{"fooba", "Zm9vYmE="},
+		{"foobar", "Zm9vYmFy"}
+	};
+
+	for (auto const &vector : vectors) {
+		BOOST_TEST(encode(vector.first) == vector.second);
+		BOOST_TEST(decode(vector.second) == vector.first);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_long)
+{
+	// Long enough for all of the vectorised implementations, and a bit of
+	// scalar tail for each of the possible lengths.
+	string alphabet;
+	for (char c = 'A'; c <= 'Z'; ++c) alphabet.push_back(c);
+	for (char c = 'a'; c <= 'z'; ++c) alphabet.push_back(c);
+	for (char c = '0'; c <= '9'; ++c) alphabet.push_back(c);
+	alphabet += "+/";
+
+	// Every character at every position within a block
+	string encoded;
+	for (size_t i = 0; i < 5; ++i)
+		encoded += alphabet;
+	BOOST_TEST(encode(decode(encoded)) == encoded);
+
+	mt19937 random(42);
+	for (size_t size = 0; size < 300; ++size) {
+		string data(size, '\0');
+		for (char &c : data)
+			c = char(random());
+
+		BOOST_TEST(decode(encode(data)) == data);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_without_padding)
+{
+	BOOST_TEST(decode("Zm9vYmE") == "fooba");
+	BOOST_TEST(decode("Zm9vYg") == "foob");
+}
+
+BOOST_AUTO_TEST_CASE(test_stops_at_padding)
+{
+	string long_text(100, 'x');
+	string encoded = encode(long_text);
+	BOOST_TEST(decode(encoded + "=" + encoded) == long_text);
+	BOOST_TEST(decode(encoded.substr(0, 8) + "====" + encoded) == long_text.substr(0, 6));
+}
+
+BOOST_AUTO_TEST_CASE(test_invalid)
+{
+	string encoded = encode(string(99, 'x'));
+
+	// Invalid characters in every position, so also inside vectorised blocks
+	for (size_t pos = 0; pos < encoded.size(); ++pos) {
+		for (char c : {' ', '\n', '-', '_', '\x80', '\0'}) {
+			string invalid = encoded;
+			invalid[pos] = c;
+			BOOST_CHECK_THROW(decode(invalid), util::Exception);
+		}
+	}
+}
@@ -0,0 +1,52 @@
+#define BOOST_TEST_MODULE chunk_reader
+#include <string>
+#include <boost/test/unit_test.hpp>
+#include "../src/chunk_reader.h"
+#include "test_files.h"
+
+using namespace bitextor;
+using namespace std;
+
+namespace {
+
+string make_text() {
+	string text;
+	for (size_t i = 0; i < 3000; ++i)
+		text += "line " + to_string(i) + string(i % 200, 'x') + "\n";
+	// Last line without a newline
+	return text + "last";
+}
+
+string read_all(string const &path, size_t threads) {
+	ChunkReader reader(path, threads);
+	string text;
+	while (shared_ptr<Chunk const> chunk = reader.next()) {
+		// Chunks only hold whole lines
+		BOOST_TEST((chunk->lines.data()[chunk->lines.size() - 1] == '\n' || string(chunk->lines.data(), chunk->lines.size()) == "last"));
+		text.append(chunk->lines.data(), chunk->lines.size());
+	}
+	return text;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(test_plain)
+{
+	string text(make_text());
+	TempFile file("chunk_reader_test.txt", text);
+	BOOST_TEST(read_all(file.path(), 1) == text);
+}
+
+BOOST_AUTO_TEST_CASE(test_bgzf)
+{
+	string text(make_text());
+	TempFile file("chunk_reader_test.gz", make_bgzf(text, 100));
+	BOOST_TEST(read_all(file.path(), 3) == text);
+}
+
+BOOST_AUTO_TEST_CASE(test_stop_early)
+{
+	TempFile file("chunk_reader_test.gz", make_bgzf(make_text(), 10));
+	ChunkReader reader(file.path(), 2);
+	BOOST_TEST(reader.next() != nullptr);
+}
@@ -3,3 +3,96 @@ set -euo pipefail
 
 docalign trg.gz ref.gz > out.txt
 ./diff.py 0.01 out.txt ref.txt
+
+# Small batch size forces compute_df to spill its counts to disk
+docalign --batch_size 100 trg.gz ref.gz > out.txt
+./diff.py 0.01 out.txt ref.txt
+
+# Same results when using an index saved by an earlier run
+docalign --save-index index.bin trg.gz ref.gz > /dev/null
+docalign --load-index index.bin ref.gz > out.txt
+./diff.py 0.01 out.txt ref.txt
+rm index.bin
+
+# Scoring shards of the English documents in separate processes, and merging
+# their pairs afterwards gives exactly the same results
+docalign --save-index index.bin trg.gz ref.gz > out.txt
+for shard in 1 2 3; do
+	docalign --load-index index.bin --shard $shard/3 --write-pairs pairs.$shard.bin ref.gz
+done
+docalign-merge pairs.1.bin pairs.2.bin pairs.3.bin | diff - out.txt
+rm index.bin pairs.1.bin pairs.2.bin pairs.3.bin
+
+# Scoring against the index in parts gives exactly the same results
+docalign trg.gz ref.gz > out.txt
+docalign --memory-limit 1 trg.gz ref.gz | diff - out.txt
+
+# Statistics do not change the output, and are valid JSON
+docalign --stats-json stats.json --progress 0.01 trg.gz ref.gz 2> /dev/null | diff - out.txt
+python3 -m json.tool stats.json > /dev/null
+rm stats.json
+
+# Approximate DF with a sketch large enough for this data stays close to the
+# exact scores, also when saved with the index
+docalign --approx-df 4 trg.gz ref.gz > out.txt
+./diff.py 0.01 out.txt ref.txt
+docalign --approx-df 4 --save-index index.bin trg.gz ref.gz > /dev/null
+docalign --load-index index.bin ref.gz | diff - out.txt
+rm index.bin
+
+# Joining with the left side looked up through a line index gives the same
+# rows whether it is compressed or not, and whether the index is cached
+docalign trg.gz ref.gz | tail -n +2 | cut -f 2,3 > pairs.txt
+zcat trg.gz > trg.txt
+docjoin -li -ri -l trg.gz -r ref.gz < pairs.txt > out.txt
+docjoin -li -ri -l trg.txt -r ref.gz < pairs.txt | diff - out.txt
+test ! -e trg.txt.lidx
+mkdir line-index
+docjoin -c line-index -li -ri -l trg.txt -r ref.gz < pairs.txt | diff - out.txt
+docjoin -li -ri -l trg.txt -r ref.gz -c line-index < pairs.txt | diff - out.txt
+test $(ls line-index | wc -l) -eq 1
+rm -r line-index pairs.txt trg.txt
+
+# Hashed documents kept from an earlier run give the same results as the
+# input files they were read from
+docalign trg.gz ref.gz > out.txt
+mkdir -p hash-cache
+docalign --hash-cache hash-cache trg.gz ref.gz | diff - out.txt
+docalign --hash-cache hash-cache trg.gz ref.gz | diff - out.txt
+test $(ls hash-cache | wc -l) -eq 2
+rm -r hash-cache
+
+# Without a directory to keep them in, the input files are read as usual
+docalign --hash-cache hash-cache trg.gz ref.gz | diff - out.txt
+
+# A server with the index loaded gives the same pairs as loading it for a
+# single run, both on stdin and stdout and through docalign-client
+docalign --save-index index.bin trg.gz ref.gz > out.txt
+(zcat ref.gz | wc -l; zcat ref.gz) | docalign --load-index index.bin --serve - | tail -n +2 | diff - <(tail -n +2 out.txt)
+docalign --load-index index.bin --serve serve.sock 2> /dev/null &
+for i in $(seq 100); do [ -S serve.sock ] && break; sleep 0.1; done
+docalign-client serve.sock ref.gz | diff - out.txt
+kill $!
+wait $!
+
+# Only a pass that counts DF writes hashed documents
+mkdir hash-cache
+docalign --load-index index.bin --hash-cache hash-cache ref.gz | diff - out.txt
+test -z "$(ls hash-cache)"
+rmdir hash-cache
+rm index.bin
+
+# Packed postings only change the scores a little
+docalign --compress-postings 8 trg.gz ref.gz > out.txt
+./diff.py 0.01 out.txt ref.txt
+
+# Cutting each English document down to its best candidates picks the same
+# pairs as greedily going through all of them, also with fewer translated
+# than English documents
+docalign-bench --documents 300 --seed 3 --zipf 1.1 --noise 0.7 --unrelated 1.0 --write-corpus corpus > /dev/null
+test $(wc -l < corpus/english.b64) -lt $(wc -l < corpus/translated.b64)
+docalign --all --threshold 0.01 corpus/english.b64 corpus/translated.b64 2> /dev/null | tail -n +2 > all.txt
+test $(cut -f 3 all.txt | sort | uniq -c | sort -nr | awk 'NR == 1 { print $1 }') -gt 8
+sort -t $'\t' -k1,1gr -k2,2nr -k3,3nr all.txt | awk -F '\t' '!(($2 in in_seen) || ($3 in en_seen)) { in_seen[$2]; en_seen[$3]; print }' | sort > best.txt
+docalign --threshold 0.01 corpus/english.b64 corpus/translated.b64 2> /dev/null | tail -n +2 | sort | diff - best.txt
+rm -r corpus all.txt best.txt
@@ -0,0 +1,59 @@
+#define BOOST_TEST_MODULE document
+#include <algorithm>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include "../src/base64.h"
+#include "../src/document.h"
+#include "../src/radix_sort.h"
+
+using namespace bitextor;
+using namespace std;
+
+BOOST_AUTO_TEST_CASE(test_radix_sort)
+{
+	mt19937_64 rng(1);
+	vector<uint64_t> buffer;
+
+	for (size_t size : {0, 1, 100, 1000, 10000}) {
+		vector<uint64_t> keys(size);
+		for (uint64_t &key : keys)
+			key = rng() >> (size % 7); // vary which high bytes are constant
+
+		vector<uint64_t> expected(keys);
+		sort(expected.begin(), expected.end());
+
+		radix_sort(keys, buffer);
+		BOOST_TEST(keys == expected);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_read_document)
+{
+	string text;
+	for (size_t i = 0; i < 2000; ++i)
+		text += "w" + to_string(i % 37) + (i % 11 == 0 ? "\n" : " ");
+
+	string encoded;
+	base64_encode(text, encoded);
+
+	unordered_map<NGram, size_t> expected;
+	for (NGramIter it(text, 2); it; ++it)
+		expected[*it] += 1;
+
+	DocumentReader reader(2);
+	Document document;
+
+	// Twice, to check the document is reset between reads
+	for (size_t round = 0; round < 2; ++round) {
+		reader.read(encoded, document);
+
+		BOOST_TEST(document.vocab.size() == expected.size());
+		for (size_t i = 1; i < document.vocab.size(); ++i)
+			BOOST_TEST(document.vocab[i - 1].hash.hash < document.vocab[i].hash.hash);
+		for (WordCount const &entry : document.vocab)
+			BOOST_TEST(entry.count == expected[entry.hash]);
+	}
+}
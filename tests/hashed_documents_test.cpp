@@ -0,0 +1,196 @@
+#define BOOST_TEST_MODULE hashed_documents
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include "../src/hashed_documents.h"
+#include "test_files.h"
+
+using namespace bitextor;
+using namespace std;
+
+namespace {
+
+// Documents with sorted hashes all over the range, and some large counts
+vector<Document> make_documents(size_t cnt) {
+	mt19937_64 rng(1);
+	vector<Document> documents(cnt);
+
+	for (size_t i = 0; i < cnt; ++i) {
+		uint64_t hash = rng() % 1000;
+		for (size_t j = 0; j < i % 50; ++j) {
+			documents[i].vocab.push_back(WordCount{.hash = NGram{hash}, .count = 1 + rng() % (j % 3 == 0 ? 100000 : 3)});
+			hash += 1 + (rng() >> 5);
+		}
+	}
+
+	return documents;
+}
+
+// Block of documents [begin, end)
+string encode_block(vector<Document> const &documents, size_t begin, size_t end) {
+	string block;
+	for (size_t i = begin; i < end; ++i)
+		encode_document(documents[i], block);
+	return block;
+}
+
+void check_documents(HashedDocumentFile const &file, vector<Document> const &documents) {
+	BOOST_REQUIRE(file.complete());
+	BOOST_TEST(file.document_cnt() == documents.size());
+
+	uint64_t offset = 0;
+	vector<char> block;
+	size_t i = 0;
+	Document document;
+
+	while (size_t cnt = file.read(offset, block)) {
+		const char *pos = block.data(), *end = pos + block.size();
+		for (size_t j = 0; j < cnt; ++j, ++i) {
+			size_t size;
+			pos = read_document_size(pos, end, size);
+			decode_document(util::StringPiece(pos, size), document);
+			pos += size;
+
+			BOOST_REQUIRE(i < documents.size());
+			BOOST_REQUIRE(document.vocab.size() == documents[i].vocab.size());
+			for (size_t k = 0; k < document.vocab.size(); ++k) {
+				BOOST_TEST(document.vocab[k].hash.hash == documents[i].vocab[k].hash.hash);
+				BOOST_TEST(document.vocab[k].count == documents[i].vocab[k].count);
+			}
+		}
+		BOOST_TEST((pos == end));
+	}
+
+	BOOST_TEST(i == documents.size());
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(test_encode)
+{
+	Document document{0, {}};
+	document.vocab.push_back(WordCount{.hash = NGram{0}, .count = 1});
+	document.vocab.push_back(WordCount{.hash = NGram{127}, .count = 128});
+	document.vocab.push_back(WordCount{.hash = NGram{UINT64_MAX}, .count = 3});
+
+	string encoded;
+	encode_document(document, encoded);
+	encode_document(Document{0, {}}, encoded);
+
+	size_t size;
+	const char *pos = read_document_size(encoded.data(), encoded.data() + encoded.size(), size);
+
+	Document decoded{0, {}};
+	decode_document(util::StringPiece(pos, size), decoded);
+	BOOST_REQUIRE(decoded.vocab.size() == 3);
+	BOOST_TEST(decoded.vocab[1].hash.hash == 127);
+	BOOST_TEST(decoded.vocab[1].count == 128);
+	BOOST_TEST(decoded.vocab[2].hash.hash == UINT64_MAX);
+
+	// The empty document after it is only its size
+	pos = read_document_size(pos + size, encoded.data() + encoded.size(), size);
+	BOOST_TEST(size == 0);
+	BOOST_TEST((pos == encoded.data() + encoded.size()));
+
+	// Sizes beyond the end are corrupt
+	BOOST_CHECK_THROW(read_document_size(encoded.data(), encoded.data() + 1, size), util::Exception);
+}
+
+BOOST_AUTO_TEST_CASE(test_blocks_in_order)
+{
+	vector<Document> documents(make_documents(1000));
+	TempFile source("hashed_documents_test.txt", "source");
+
+	{
+		HashedDocumentFile file(source.path(), 2, ".");
+		BOOST_TEST(!file.complete());
+
+		// Blocks added out of order end up in order
+		file.add(2, 400, encode_block(documents, 600, 1000));
+		file.add(0, 100, encode_block(documents, 0, 100));
+		BOOST_TEST(!file.complete());
+		file.add(1, 500, encode_block(documents, 100, 600));
+		file.finish(documents.size());
+
+		check_documents(file, documents);
+		remove(file.path().c_str());
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_missing_block)
+{
+	vector<Document> documents(make_documents(100));
+	TempFile source("hashed_documents_test.txt", "source");
+
+	{
+		HashedDocumentFile file(source.path(), 2, ".");
+		file.add(1, 50, encode_block(documents, 50, 100));
+		file.finish(documents.size());
+
+		BOOST_TEST(!file.complete());
+		BOOST_TEST(!file.writable());
+	}
+
+	// Nothing is left behind
+	HashedDocumentFile file(source.path(), 2, ".", false);
+	BOOST_TEST(!file.complete());
+}
+
+BOOST_AUTO_TEST_CASE(test_not_created)
+{
+	TempFile source("hashed_documents_test.txt", "source");
+
+	// A directory that isn't there is no reason to fail
+	HashedDocumentFile missing(source.path(), 2, "hashed_documents_test_missing");
+	BOOST_TEST(!missing.complete());
+	BOOST_TEST(!missing.writable());
+
+	// Neither is a source that can't be recognised again
+	HashedDocumentFile absent("hashed_documents_test_absent.txt", 2, ".");
+	BOOST_TEST(!absent.writable());
+
+	// Without create, only an earlier run can have made them
+	HashedDocumentFile uncreated(source.path(), 2, ".", false);
+	BOOST_TEST(!uncreated.complete());
+	BOOST_TEST(!uncreated.writable());
+}
+
+BOOST_AUTO_TEST_CASE(test_kept)
+{
+	vector<Document> documents(make_documents(300));
+	TempFile source("hashed_documents_test.txt", "source");
+
+	string path;
+
+	{
+		HashedDocumentFile file(source.path(), 2, ".");
+		BOOST_TEST(!file.complete());
+		file.add(0, documents.size(), encode_block(documents, 0, documents.size()));
+		file.finish(documents.size());
+		check_documents(file, documents);
+		path = file.path();
+	}
+
+	{
+		HashedDocumentFile file(source.path(), 2, ".");
+		check_documents(file, documents);
+		BOOST_TEST(file.path() == path);
+	}
+
+	// Not for another ngram size, nor once the source changed
+	{
+		HashedDocumentFile file(source.path(), 3, ".");
+		BOOST_TEST(!file.complete());
+	}
+
+	source.write("changed source");
+
+	{
+		HashedDocumentFile file(source.path(), 2, ".");
+		BOOST_TEST(!file.complete());
+	}
+
+	remove(path.c_str());
+}
@@ -0,0 +1,132 @@
+#define BOOST_TEST_MODULE line_index
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include <boost/test/unit_test.hpp>
+#include "../src/cache_path.h"
+#include "../src/line_index.h"
+#include "test_files.h"
+
+using namespace bitextor;
+using namespace std;
+
+namespace {
+
+vector<string> make_lines() {
+	vector<string> lines;
+	for (size_t i = 0; i < 3000; ++i)
+		lines.push_back("line " + to_string(i) + string(i % 200, 'x'));
+	lines.push_back("");
+	lines.push_back("windows\r");
+	lines.push_back("last");
+	return lines;
+}
+
+// Last line without a newline
+string make_text(vector<string> const &lines) {
+	string text;
+	for (string const &line : lines)
+		text += line + "\n";
+	text.pop_back();
+	return text;
+}
+
+// Reads the lines out of order, like docjoin does across batches
+void check_lines(LineIndex &index, vector<string> const &lines) {
+	BOOST_TEST(index.size() == lines.size());
+
+	string line;
+	for (size_t i = 0; i < lines.size(); i += 7) {
+		index.read(lines.size() - 1 - i, line);
+		string expected(lines[lines.size() - 1 - i]);
+		if (!expected.empty() && expected.back() == '\r')
+			expected.pop_back();
+		BOOST_TEST(line == expected);
+	}
+
+	for (size_t i = 0; i < lines.size(); ++i) {
+		index.read(i, line);
+		BOOST_TEST(line == (i == lines.size() - 2 ? "windows" : lines[i]));
+	}
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(test_plain)
+{
+	vector<string> lines(make_lines());
+	TempFile file("line_index_test.txt", make_text(lines));
+	string cached(cache_path(".", file.path(), "lidx"));
+	remove(cached.c_str());
+
+	// Nothing is kept without a directory
+	{
+		LineIndex index(file.path());
+		BOOST_TEST(!index.cached());
+		check_lines(index, lines);
+	}
+
+	{
+		LineIndex index(file.path(), ".");
+		BOOST_TEST(!index.cached());
+		check_lines(index, lines);
+	}
+
+	{
+		LineIndex index(file.path(), ".");
+		BOOST_TEST(index.cached());
+		check_lines(index, lines);
+	}
+
+	remove(cached.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(test_empty)
+{
+	TempFile file("line_index_test.txt", "");
+	LineIndex index(file.path());
+	BOOST_TEST(index.size() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_bgzf)
+{
+	vector<string> lines(make_lines());
+	string text(make_text(lines) + "\n");
+
+	// Blocks of 100 bytes end right after a newline every now and then
+	TempFile file("line_index_test.gz", make_bgzf(text, 100));
+	string cached(cache_path(".", file.path(), "lidx"));
+	remove(cached.c_str());
+
+	{
+		LineIndex index(file.path(), ".");
+		check_lines(index, lines);
+	}
+
+	{
+		LineIndex index(file.path(), ".");
+		BOOST_TEST(index.cached());
+		check_lines(index, lines);
+	}
+
+	remove(cached.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(test_gzip)
+{
+	vector<string> lines(make_lines());
+	string text(make_text(lines));
+
+	gzFile file = gzopen("line_index_test.gz", "wb");
+	gzwrite(file, text.data(), text.size());
+	gzclose(file);
+
+	{
+		LineIndex index("line_index_test.gz", ".");
+		BOOST_TEST(!index.cached());
+		check_lines(index, lines);
+	}
+
+	remove("line_index_test.gz");
+}
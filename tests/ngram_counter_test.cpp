@@ -0,0 +1,80 @@
+#define BOOST_TEST_MODULE ngram_counter
+#include <map>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include "../src/ngram_counter.h"
+#include "../src/thread_pool.h"
+
+using namespace bitextor;
+using namespace std;
+
+namespace {
+
+// Spread out over the whole hash range, including hash 0, with some ngrams
+// occurring much more often than others
+uint64_t make_hash(size_t i) {
+	size_t n = i % 5000 < 100 ? i % 100 : i % 20000;
+	return n * 0x9E3779B97F4A7C15ull;
+}
+
+map<uint64_t, size_t> exact_counts(size_t cnt) {
+	map<uint64_t, size_t> counts;
+	for (size_t i = 0; i < cnt; ++i)
+		++counts[make_hash(i)];
+	return counts;
+}
+
+// Checks that the merged counts come in hash order and match the exact ones
+void check_merged(map<uint64_t, size_t> const &expected, function<void (function<void (NGramCount const &)>)> merge) {
+	vector<NGramCount> merged;
+	merge([&merged](NGramCount const &entry) {
+		merged.push_back(entry);
+	});
+
+	BOOST_REQUIRE(merged.size() == expected.size());
+
+	auto it = expected.begin();
+	for (NGramCount const &entry : merged) {
+		BOOST_TEST(entry.ngram.hash == it->first);
+		BOOST_TEST(entry.count == it->second);
+		++it;
+	}
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(test_spill)
+{
+	// Small enough to grow the table and spill plenty of runs
+	vector<NGramCounter> counters;
+	counters.emplace_back(3000);
+	counters.emplace_back(100000);
+
+	for (size_t i = 0; i < 200000; ++i)
+		counters[i % 2].add(NGram{make_hash(i)});
+
+	BOOST_TEST(counters[0].runs() > 0);
+	BOOST_TEST(counters[1].runs() == 0);
+
+	check_merged(exact_counts(200000), [&counters](function<void (NGramCount const &)> callback) {
+		merge_counts(counters, callback);
+	});
+}
+
+BOOST_AUTO_TEST_CASE(test_concurrent)
+{
+	ThreadPool pool(4, 16);
+	ConcurrentNGramCounter counter(1 << 18, pool.size());
+
+	for (size_t begin = 0; begin < 400000; begin += 1000)
+		pool.submit([&counter, begin](size_t worker) {
+			for (size_t i = begin; i < begin + 1000; ++i)
+				counter.add(worker, NGram{make_hash(i)});
+		});
+
+	pool.wait();
+
+	check_merged(exact_counts(400000), [&counter](function<void (NGramCount const &)> callback) {
+		counter.merge(callback);
+	});
+}
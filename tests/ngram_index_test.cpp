@@ -0,0 +1,102 @@
+#define BOOST_TEST_MODULE ngram_index
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include "../src/ngram_index.h"
+#include "../src/thread_pool.h"
+
+using namespace bitextor;
+using namespace std;
+
+BOOST_AUTO_TEST_CASE(test_empty)
+{
+	NGramIndex index;
+	BOOST_TEST(index.find(NGram{42}).empty());
+	BOOST_TEST(index.size() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_find)
+{
+	ThreadPool pool(2, 16);
+	IndexBuilder builder(4);
+	builder.add(3, IndexEntry{NGram{3}, 3, 0.125f});
+	builder.add(0, IndexEntry{NGram{3}, 1, 0.5f});
+	builder.add(0, IndexEntry{NGram{1}, 1, 0.25f});
+	builder.add(1, IndexEntry{NGram{3}, 2, 0.75f});
+	builder.add(3, IndexEntry{NGram{1 << 20}, 3, 1.0f});
+
+	NGramIndex index(std::move(builder), pool);
+
+	BOOST_TEST(index.size() == 3);
+	BOOST_TEST(index.postings() == 5);
+	BOOST_TEST(index.find(NGram{2}).empty());
+
+	vector<uint32_t> doc_ids;
+	for (auto const &posting : index.find(NGram{3}))
+		doc_ids.push_back(posting.doc_id);
+	BOOST_TEST(doc_ids == vector<uint32_t>({1, 2, 3}), boost::test_tools::per_element());
+
+	BOOST_TEST(index.find(NGram{1}).size() == 1);
+	BOOST_TEST(index.find(NGram{1}).begin()->tfidf == 0.25f);
+	BOOST_TEST(index.find(NGram{1 << 20}).begin()->doc_id == 3);
+
+	BOOST_TEST(index.bound(index.lookup(NGram{3})) == 0.75f);
+	BOOST_TEST(index.bound(index.lookup(NGram{1})) == 0.25f);
+}
+
+BOOST_AUTO_TEST_CASE(test_many_keys)
+{
+	// Keys with the same top bits all want the same slot, and keys at the end
+	// of a shard run into the next one, or around the end of the table.
+	vector<uint64_t> hashes;
+	for (uint64_t i = 0; i < 1000; ++i)
+		hashes.push_back(i);
+	for (uint64_t shard = 1; shard <= IndexBuilder::kShards; ++shard)
+		for (uint64_t i = 1; i <= 8; ++i)
+			hashes.push_back((shard << (64 - IndexBuilder::kShardBits)) - i);
+
+	ThreadPool pool(2, 16);
+	IndexBuilder builder(2);
+	for (uint32_t i = 0; i < hashes.size(); ++i)
+		builder.add(i % 2, IndexEntry{NGram{hashes[i]}, i, float(i)});
+
+	NGramIndex index(std::move(builder), pool);
+
+	BOOST_TEST(index.size() == hashes.size());
+	for (uint32_t i = 0; i < hashes.size(); ++i) {
+		auto postings = index.find(NGram{hashes[i]});
+		BOOST_REQUIRE(postings.size() == 1);
+		BOOST_TEST(postings.begin()->doc_id == i);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_pack)
+{
+	ThreadPool pool(1, 16);
+	IndexBuilder builder(1);
+	for (uint32_t i = 1; i <= 300; ++i)
+		builder.add(0, IndexEntry{NGram{i % 3}, i * 1000, 1.0f / i});
+
+	NGramIndex index(std::move(builder), pool);
+	index.pack(16);
+
+	BOOST_TEST(index.packed());
+	BOOST_TEST(index.postings() == 300);
+	BOOST_TEST(index.find_packed(NGram{3}).empty());
+
+	PackedPostingList postings(index.find_packed(NGram{1}));
+	BOOST_TEST(postings.size() == 100);
+
+	// Stops at the first doc id past the end, and continues from there
+	vector<uint32_t> doc_ids;
+	postings.read_until(10000, [&](uint32_t doc_id, float tfidf) {
+		doc_ids.push_back(doc_id);
+		BOOST_TEST(tfidf == 1000.0f / doc_id, boost::test_tools::tolerance(0.001f));
+	});
+	BOOST_TEST(doc_ids == vector<uint32_t>({1000, 4000, 7000}), boost::test_tools::per_element());
+
+	postings.read_until(1000000, [&](uint32_t doc_id, float) {
+		doc_ids.push_back(doc_id);
+	});
+	BOOST_TEST(doc_ids.size() == 100);
+	BOOST_TEST(doc_ids.back() == 298000);
+}
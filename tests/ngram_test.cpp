@@ -69,3 +69,27 @@ BOOST_AUTO_TEST_CASE(test_not_enough_tokens)
 
 	BOOST_TEST(ngrams.size() == 0);
 }
+
+BOOST_AUTO_TEST_CASE(test_batches)
+{
+	// Enough tokens to span multiple batches, with runs of delimiters and
+	// tokens longer than 16 characters.
+	vector<string> words;
+	string document = "  \n";
+	for (size_t i = 0; i < 500; ++i) {
+		words.push_back(i % 7 == 0 ? "a-rather-long-token-" + to_string(i) : "w" + to_string(i));
+		document += words.back() + (i % 13 == 0 ? " \n  " : " ");
+	}
+
+	for (size_t ngram_size : {1, 2, 5, 7}) {
+		vector<NGram> ngrams;
+		for (NGramIter iter(util::StringPiece(document.data(), document.size()), ngram_size); iter; ++iter)
+			ngrams.push_back(*iter);
+
+		vector<NGram> expected;
+		for (size_t i = 0; i + ngram_size <= words.size(); ++i)
+			expected.push_back(make_ngram(vector<string>(words.begin() + i, words.begin() + i + ngram_size)));
+
+		BOOST_TEST(ngrams == expected, boost::test_tools::per_element());
+	}
+}
@@ -0,0 +1,61 @@
+#define BOOST_TEST_MODULE ring_queue
+#include <thread>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include "../src/ring_queue.h"
+
+using namespace bitextor;
+using namespace std;
+
+BOOST_AUTO_TEST_CASE(test_batch_pop)
+{
+	ring_queue<size_t> queue(8);
+	for (size_t i = 1; i <= 5; ++i)
+		queue.push(i);
+
+	size_t items[8];
+	BOOST_TEST(queue.pop(items, 3) == 3);
+	BOOST_TEST(items[0] == 1);
+	BOOST_TEST(items[2] == 3);
+	BOOST_TEST(queue.pop(items, 8) == 2);
+	BOOST_TEST(items[1] == 5);
+}
+
+BOOST_AUTO_TEST_CASE(test_many_threads)
+{
+	// Small queue so producers and consumers both end up parking
+	ring_queue<size_t> queue(4);
+
+	const size_t n_threads = 8, n_items = 5000;
+	vector<size_t> sums(n_threads, 0);
+
+	vector<thread> consumers;
+	for (size_t i = 0; i < n_threads; ++i)
+		consumers.emplace_back([&queue, &sums, i]() {
+			// 0 is poison
+			for (size_t item; (item = queue.pop()) != 0;)
+				sums[i] += item;
+		});
+
+	vector<thread> producers;
+	for (size_t i = 0; i < n_threads; ++i)
+		producers.emplace_back([&queue]() {
+			for (size_t item = 1; item <= n_items; ++item)
+				queue.push(item);
+		});
+
+	for (thread &producer : producers)
+		producer.join();
+
+	for (size_t i = 0; i < n_threads; ++i)
+		queue.push(0);
+
+	for (thread &consumer : consumers)
+		consumer.join();
+
+	size_t total = 0;
+	for (size_t sum : sums)
+		total += sum;
+
+	BOOST_TEST(total == n_threads * n_items * (n_items + 1) / 2);
+}
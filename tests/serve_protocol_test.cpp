@@ -0,0 +1,92 @@
+#define BOOST_TEST_MODULE serve_protocol
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <boost/test/unit_test.hpp>
+#include "../src/serve_protocol.h"
+
+using namespace bitextor;
+using namespace std;
+
+namespace {
+
+// Both ends of a connected pair of sockets
+struct SocketPair {
+	SocketPair() {
+		BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	}
+
+	~SocketPair() {
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	int fds[2];
+};
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(test_request_and_response)
+{
+	SocketPair sockets;
+	LineConnection client(sockets.fds[0], sockets.fds[0]);
+	LineConnection server(sockets.fds[1], sockets.fds[1]);
+
+	// Large enough not to fit in the buffers at once, so the server has to
+	// read while the client is still writing.
+	vector<string> documents{"", "YWJj", string(100000, 'Q')};
+	for (size_t i = 0; i < 1000; ++i)
+		documents.push_back("ZG9jdW1lbnQ" + to_string(i));
+
+	thread writer([&]() {
+		BOOST_CHECK(write_request(client, documents));
+	});
+
+	vector<string> received;
+	string error;
+	BOOST_TEST(read_request(server, received, error));
+	BOOST_TEST(error.empty());
+	BOOST_TEST(received == documents);
+	writer.join();
+
+	vector<DocumentPair> pairs{{0.5f, 3, 1}, {0.25f, 7, 2}};
+	BOOST_TEST(write_response(server, pairs));
+
+	vector<string> lines;
+	BOOST_TEST(read_response(client, lines, error));
+	BOOST_TEST(lines == vector<string>({"0.50000\t3\t1", "0.25000\t7\t2"}));
+
+	// The end of the input is not an error
+	shutdown(sockets.fds[0], SHUT_WR);
+	BOOST_TEST(!read_request(server, received, error));
+	BOOST_TEST(error.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_malformed_request)
+{
+	SocketPair sockets;
+	LineConnection client(sockets.fds[0], sockets.fds[0]);
+	LineConnection server(sockets.fds[1], sockets.fds[1]);
+
+	vector<string> received;
+	string error;
+
+	BOOST_TEST(client.write("many\n"));
+	BOOST_TEST(!read_request(server, received, error));
+	BOOST_TEST(!error.empty());
+
+	// The error reaches the client
+	BOOST_TEST(write_error(server, error));
+	vector<string> lines;
+	string sent;
+	BOOST_TEST(!read_response(client, lines, sent));
+	BOOST_TEST(sent == error);
+
+	// Cut off in the middle of the documents
+	BOOST_TEST(client.write("3\nYWJj\n"));
+	shutdown(sockets.fds[0], SHUT_WR);
+	BOOST_TEST(!read_request(server, received, error));
+	BOOST_TEST(error == "request ended after 1 of 3 documents");
+}
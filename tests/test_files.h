@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include <boost/test/unit_test.hpp>
+
+namespace bitextor {
+
+/**
+ * File with the given contents in the working directory of a test, removed
+ * again once it goes out of scope.
+ */
+class TempFile {
+public:
+	TempFile(std::string const &path, std::string const &data)
+	: path_(path) {
+		write(data);
+	}
+
+	~TempFile() {
+		std::remove(path_.c_str());
+	}
+
+	TempFile(TempFile const &other) = delete;
+	TempFile &operator=(TempFile const &other) = delete;
+
+	// Replaces the contents
+	void write(std::string const &data) {
+		std::FILE *file = std::fopen(path_.c_str(), "wb");
+		BOOST_REQUIRE(file);
+		BOOST_REQUIRE(std::fwrite(data.data(), 1, data.size(), file) == data.size());
+		std::fclose(file);
+	}
+
+	inline std::string const &path() const { return path_; }
+
+private:
+	std::string path_;
+};
+
+inline void put_le(std::string &out, uint32_t value, size_t bytes) {
+	for (size_t i = 0; i < bytes; ++i)
+		out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+}
+
+/**
+ * Compresses text into BGZF blocks of `block_size` bytes of text each, like
+ * bgzip does with blocks of 64 KB. Small blocks make lines span several of
+ * them.
+ */
+inline std::string make_bgzf(std::string const &text, size_t block_size) {
+	std::string out;
+	for (size_t pos = 0; pos <= text.size(); pos += block_size) {
+		std::string part = text.substr(pos, block_size);
+
+		z_stream stream;
+		std::memset(&stream, 0, sizeof(stream));
+		deflateInit2(&stream, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+		std::vector<char> compressed(deflateBound(&stream, part.size()));
+		stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(part.data()));
+		stream.avail_in = part.size();
+		stream.next_out = reinterpret_cast<Bytef *>(compressed.data());
+		stream.avail_out = compressed.size();
+		deflate(&stream, Z_FINISH);
+		compressed.resize(stream.total_out);
+		deflateEnd(&stream);
+
+		out += std::string("\x1f\x8b\x08\x04\0\0\0\0\0\xff", 10);
+		put_le(out, 6, 2);
+		out += "BC";
+		put_le(out, 2, 2);
+		put_le(out, 18 + compressed.size() + 8 - 1, 2);
+		out.append(compressed.data(), compressed.size());
+		put_le(out, crc32(0, reinterpret_cast<Bytef const *>(part.data()), part.size()), 4);
+		put_le(out, part.size(), 4);
+	}
+	return out;
+}
+
+} // namespace bitextor
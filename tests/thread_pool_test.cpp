@@ -0,0 +1,53 @@
+#define BOOST_TEST_MODULE thread_pool
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include "../src/thread_pool.h"
+
+using namespace bitextor;
+using namespace std;
+
+BOOST_AUTO_TEST_CASE(test_all_tasks_run)
+{
+	ThreadPool pool(4, 8);
+	vector<size_t> sums(pool.size(), 0);
+
+	// More tasks than fit in the queue, and tasks that submit more tasks
+	for (size_t i = 1; i <= 1000; ++i)
+		pool.submit([&pool, &sums, i](size_t worker) {
+			sums[worker] += i;
+			pool.submit([&sums, i](size_t worker) {
+				sums[worker] += i;
+			});
+		});
+
+	pool.wait();
+
+	size_t total = 0;
+	for (size_t sum : sums)
+		total += sum;
+
+	BOOST_TEST(total == 2 * 1000 * 1001 / 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_exception)
+{
+	ThreadPool pool(2, 4);
+	atomic<size_t> count(0);
+
+	for (size_t i = 0; i < 10; ++i)
+		pool.submit([&count, i](size_t) {
+			++count;
+			if (i == 5)
+				throw runtime_error("task failed");
+		});
+
+	BOOST_CHECK_THROW(pool.wait(), runtime_error);
+	BOOST_TEST(count == 10);
+
+	// The pool is still usable afterwards
+	pool.submit([&count](size_t) { ++count; });
+	pool.wait();
+	BOOST_TEST(count == 11);
+}